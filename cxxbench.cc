@@ -0,0 +1,178 @@
+/*
+ * cxxbench.cc - Time STL container workloads on mm against the default
+ *               allocator
+ *
+ * Each workload runs three ways: with std::allocator (libc malloc via
+ * global new), with mm_allocator<T>, and as std::pmr containers on
+ * mm_memory_resource. The best of several runs is reported, and the mm
+ * heap is reset before every run so each one starts from an empty heap.
+ *
+ * usage: cxxbench [-n <elements>] [-r <runs>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mm_cxx.h"
+
+typedef std::basic_string<char, std::char_traits<char>, mm_allocator<char> >
+    mm_string;
+
+static int num_elems = 20000;
+static int num_runs = 5;
+
+/* Keys are a fixed pseudo-random permutation so every variant sees the same */
+static std::vector<int> keys;
+
+/*
+ * best_secs - Best wall-clock time of num_runs calls to f
+ */
+static double best_secs(const std::function<void()> &f, bool reset_mm)
+{
+    double best = 1e30;
+
+    for (int i = 0; i < num_runs; i++) {
+        if (reset_mm) {
+            mem_reset_brk();
+            if (mm_init() < 0) {
+                fprintf(stderr, "mm_init failed\n");
+                exit(1);
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> d =
+            std::chrono::steady_clock::now() - start;
+        if (d.count() < best)
+            best = d.count();
+    }
+    return best;
+}
+
+/* Insert every key, look every key up, then erase them all */
+template <class Map>
+static void map_workload(Map &m)
+{
+    long sum = 0;
+
+    for (int k : keys)
+        m[k] = k;
+    for (int k : keys)
+        sum += m.find(k)->second;
+    for (int k : keys)
+        m.erase(k);
+    if (sum == 42)
+        printf(" ");
+}
+
+/* Build strings too long for the small-string buffer, then drop them */
+template <class Vec>
+static void string_workload(Vec &v)
+{
+    for (int k : keys)
+        v.emplace_back(40 + k % 40, 'a' + k % 26);
+    for (size_t i = 0; i < v.size(); i += 2)
+        v[i].append(17, 'z');
+    v.clear();
+    v.shrink_to_fit();
+}
+
+static void report(const char *name, double std_secs, double mm_secs,
+                   double pmr_secs)
+{
+    printf("%-28s%10.3f%10.3f%10.3f%9.2fx\n", name, std_secs * 1e3,
+           mm_secs * 1e3, pmr_secs * 1e3, std_secs / mm_secs);
+}
+
+int main(int argc, char **argv)
+{
+    std::pmr::memory_resource *res;
+    double t_std, t_mm, t_pmr;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:r:")) != EOF) {
+        switch (c) {
+        case 'n':
+            num_elems = atoi(optarg);
+            break;
+        case 'r':
+            num_runs = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: cxxbench [-n <elements>] [-r <runs>]\n");
+            exit(1);
+        }
+    }
+
+    if (!mm_cxx_init()) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    res = mm_memory_resource::get();
+
+    keys.resize(num_elems);
+    for (int i = 0; i < num_elems; i++)
+        keys[i] = i;
+    srand(1);
+    for (int i = num_elems - 1; i > 0; i--)
+        std::swap(keys[i], keys[rand() % (i + 1)]);
+
+    printf("%d elements, best of %d runs, times in ms\n", num_elems,
+           num_runs);
+    printf("%-28s%10s%10s%10s%10s\n", "workload", "std", "mm", "pmr(mm)",
+           "std/mm");
+
+    t_std = best_secs([] {
+        std::map<int, int> m;
+        map_workload(m);
+    }, false);
+    t_mm = best_secs([] {
+        std::map<int, int, std::less<int>,
+                 mm_allocator<std::pair<const int, int> > > m;
+        map_workload(m);
+    }, true);
+    t_pmr = best_secs([res] {
+        std::pmr::map<int, int> m(res);
+        map_workload(m);
+    }, true);
+    report("std::map<int,int>", t_std, t_mm, t_pmr);
+
+    t_std = best_secs([] {
+        std::unordered_map<int, int> m;
+        map_workload(m);
+    }, false);
+    t_mm = best_secs([] {
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                           mm_allocator<std::pair<const int, int> > > m;
+        map_workload(m);
+    }, true);
+    t_pmr = best_secs([res] {
+        std::pmr::unordered_map<int, int> m(res);
+        map_workload(m);
+    }, true);
+    report("std::unordered_map<int,int>", t_std, t_mm, t_pmr);
+
+    t_std = best_secs([] {
+        std::vector<std::string> v;
+        string_workload(v);
+    }, false);
+    t_mm = best_secs([] {
+        std::vector<mm_string, mm_allocator<mm_string> > v;
+        string_workload(v);
+    }, true);
+    t_pmr = best_secs([res] {
+        std::pmr::vector<std::pmr::string> v(res);
+        string_workload(v);
+    }, true);
+    report("std::vector<std::string>", t_std, t_mm, t_pmr);
+
+    return 0;
+}
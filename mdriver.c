@@ -7,20 +7,36 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for RUSAGE_THREAD and sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <stdint.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <sched.h>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "tracez.h"
 #include "config.h"
 
+/* The trace "make compiled" links in (see rep2c.c), if any */
+extern const char *mm_compiled_trace __attribute__((weak));
+extern const int mm_compiled_ops __attribute__((weak));
+extern int mm_compiled_replay(void) __attribute__((weak));
+
 /**********************
  * Constants and macros
  **********************/
@@ -60,8 +76,20 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    unsigned long long *stamps; /* capture time of each request in ns,
+				   or NULL if the trace is untimed */
 } trace_t;
 
+/* Reads a tracefile one request at a time, for the single pass (-s) */
+typedef struct {
+    FILE *fp;
+    char *path;
+    tz_reader_t *reader;       /* NULL for a text tracefile */
+    tz_op_t ops[TZ_BLOCK_OPS]; /* the compressed block being read */
+    int n;                     /* requests in it */
+    int next;                  /* the next one to hand out */
+} trace_stream_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -72,6 +100,16 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* An allocator a trace can be replayed on (replay_trace) */
+typedef struct {
+    void *(*malloc_fn)(size_t size);
+    void *(*realloc_fn)(void *ptr, size_t size);
+    void (*free_fn)(void *ptr);
+} allocator_t;
+
+/* Called by replay_trace after request i of the trace, with its arg */
+typedef void (*replay_hook_t)(trace_t *trace, int i, void *arg);
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -80,11 +118,176 @@ typedef struct {
     double secs;     /* number of secs needed to run the trace */
 
     /* defined only for the student malloc package */
-    double util;     /* space utilization for this trace (always 0 for libc) */
+    double util;     /* space utilization for this trace (for libc, from
+			mallinfo2's arena + hblkhd) */
+
+    /* residency in one more replay: mincore on freshly discarded pages
+       for mm, libc's [heap] Rss plus its mmapped blocks for libc */
+    double rss_util; /* peak live bytes over heap bytes resident then */
+    double rss_end;  /* heap bytes resident at the end */
+
+    /* time the single pass (-s) spent outside mm: reading the trace,
+       checking blocks and the per-request timer */
+    double check_secs;
+
+    /* time the same replay takes with a null allocator (-N) */
+    double harness_secs;
+
+    /* time the trace takes compiled into straight-line calls (-c) */
+    double compiled_secs;
+
+    /* page faults (getrusage) in one untimed replay before the timed ones */
+    double minflt;   /* minor faults */
+    double majflt;   /* major faults */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Per-request latency of a replay, in usecs */
+typedef struct {
+    double p50;        /* median */
+    double p99;        /* 99th percentile */
+    double p999;       /* 99.9th percentile */
+    double max;        /* worst */
+} latency_t;
+
+/* Summarizes a replay of a timed trace that honors its request gaps */
+typedef struct {
+    int timed;         /* did the trace carry timestamps? */
+    latency_t lat;     /* per-op latency */
+    double gap_secs;   /* time the pacing left idle between requests */
+    double idle_secs;  /* part of that spent doing work in mm_idle() */
+    int idle_calls;    /* number of mm_idle() calls that did work */
+    int late_ops;      /* number of requests that started behind schedule */
+    double max_lag;    /* furthest behind schedule a request started, secs */
+} timed_t;
+
+/* Summarizes a replay of a trace with the heap capped (-M) */
+typedef struct {
+    int valid;          /* did mm stay correct while running out of room? */
+    int fails;          /* number of mallocs and reallocs that returned NULL */
+    int handler_calls;  /* number of times mm asked the driver for memory */
+    double released;    /* bytes the driver's cache freed in response */
+    double heapsize;    /* heap size in bytes at the end of the trace */
+} pressure_t;
+
+/* Summarizes the effect of mm's quick classes on one trace (-q) */
+typedef struct {
+    int valid;          /* was the trace valid? */
+    double util_off;    /* space utilization with quick classes off (the default) */
+    double util_on;     /* space utilization with them on */
+    double hits;        /* mallocs served from quick lists */
+    int added;          /* quick classes made during the trace */
+    int retired;        /* quick classes retired during the trace */
+} quick_t;
+
+/* Summarizes a warm start of mm from a profile of an earlier run (-w) */
+typedef struct {
+    int valid;          /* was mm still correct when warmed up? */
+    int classes;        /* quick classes in the profile */
+    double util_cold;   /* space utilization from a cold start */
+    double util_warm;   /* space utilization from a warm start */
+    latency_t cold;     /* warmup latency from a cold start */
+    latency_t warm;     /* warmup latency from a warm start */
+} warm_t;
+
+/* Summarizes mm with its maintenance done inline or in the background (-B) */
+typedef struct {
+    int valid;          /* was mm still correct with the thread running? */
+    latency_t inline_lat; /* latency with maintenance inline */
+    latency_t bg_lat;   /* latency with the maintenance thread */
+    double steps;       /* work steps the thread did */
+    double usecs;       /* time it spent on them */
+    double pooled;      /* mm_callocs served from its zero pool (-C) */
+} maint_t;
+
+/* Summarizes page faults with and without memlib's runway (-P) */
+typedef struct {
+    int valid;          /* was mm still correct with the runway? */
+    double faults_off;  /* faults on the replaying thread without it */
+    double faults_on;   /* faults on the replaying thread with it */
+    double prefaulted;  /* pages the runway thread faulted in */
+    latency_t off;      /* latency without the runway */
+    latency_t on;       /* latency with the runway */
+} fault_t;
+
+/* Summarizes the heap growth calls of one replay (-S, -H brk) */
+typedef struct {
+    int valid;          /* was the trace replayed? */
+    double calls;       /* mem_sbrk calls */
+    double usecs;       /* time they took */
+    double secs;        /* time of the whole replay */
+} sbrk_t;
+
+/* Summarizes throughput with the heap at a sweep of offsets (-O) */
+#define COLOR_STEPS 8   /* number of offsets swept */
+typedef struct {
+    int valid;          /* was the trace replayed? */
+    double secs[COLOR_STEPS]; /* replay time at each offset, 0 if unmapped */
+} color_t;
+
+/* An allocator loaded from a shared object for A/B runs (-D), with
+   a memlib heap of its own */
+#define AB_MAX_LIBS 4
+typedef struct {
+    char *path;
+    void (*mem_reset_brk)(void);
+    int (*mm_init)(void);
+    void *(*mem_heap_lo)(void);
+    void *(*mem_heap_hi)(void);
+    allocator_t alloc;  /* its mm_malloc, mm_realloc and mm_free */
+} ab_lib_t;
+
+/* Summarizes the interleaved replays of one trace on every -D library */
+#define AB_RUNS 20      /* timed replays per trace and library */
+#define AB_T95  2.093   /* Student's t at 95% for AB_RUNS-1 degrees
+			   of freedom */
+typedef struct {
+    int valid;          /* did every library pass the checks? */
+    double ops;         /* requests in the trace */
+    double secs[AB_MAX_LIBS][AB_RUNS]; /* time of each replay */
+} ab_t;
+
+/* State of time_request: every request's time, and a clock reading */
+typedef struct {
+    unsigned long long *ns;    /* time of each request */
+    unsigned long long start;  /* when the next request started */
+} timing_t;
+
+/* State of mm_resident_hook, eval_mm_resident's hook */
+typedef struct {
+    int peak_op;        /* request after which live bytes peak */
+    int max_total_size; /* the peak */
+    stats_t *stats;     /* where the residency goes */
+} resident_t;
+
+/* State of pace_request, eval_mm_timed's hook */
+typedef struct {
+    timing_t timing;    /* each request's time */
+    double scale;       /* scale of the capture time gaps */
+    unsigned long long t0; /* when the first request started */
+    unsigned long long gap, idle, lag; /* ns of pacing, idle work, lag */
+    int calls, late;    /* mm_idle() calls that worked, late requests */
+} pacing_t;
+
+/* State of ab_check_hook, ab_valid's hook */
+typedef struct {
+    ab_lib_t *lib;      /* the library being checked */
+    int tracenum;       /* for error messages */
+    range_t *ranges;    /* extent of every live payload */
+    char **blocks;      /* each id's payload as of its last request */
+    int ok;             /* has every request passed so far? */
+} ab_check_t;
+
+/* State of libc_util_hook, eval_libc_util's hook */
+typedef struct {
+    int peak_op;          /* request after which live bytes peak */
+    int max_total_size;   /* the peak */
+    size_t max_footprint; /* most libc_footprint() so far */
+    size_t base;          /* libc_in_use() before the replay */
+    stats_t *stats;       /* where the residency goes */
+} libc_util_t;
+
 /********************
  * Global variables
  *******************/
@@ -100,37 +303,159 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* 
+ * Under a heap cap (-M), the driver acts like an application that keeps
+ * a cache of blocks it can release when mm runs out of memory.
+ */
+#define APP_CACHE_BLOCK 4000  /* byte size of each cached block */
+static char **app_cache;           /* the cached blocks, released LIFO */
+static int app_cache_len;          /* number of blocks still cached */
+static range_t **app_cache_ranges; /* range list the blocks live in */
+static int app_cache_calls;        /* number of release requests */
+static double app_cache_released;  /* bytes released so far */
+
+/* The warmup timed by -w, and how many times latency runs are replayed */
+#define WARMUP_OPS   2048
+#define LATENCY_RUNS 5
+
+/* Blocks per size eval_libc_util takes out of libc's thread cache,
+   for every size the cache holds */
+#define LIBC_CACHE_DEPTH 16
+#define LIBC_CACHED      (64 * LIBC_CACHE_DEPTH)
+
+/* Where the heap goes for -O unless -A says */
+#if UINTPTR_MAX > 0xffffffffUL
+#define HEAP_BASE    0x200000000000UL
+#else
+#define HEAP_BASE    0x60000000UL
+#endif
+
+/* The single pass (-s) fills and checks one block id in SINGLE_SAMPLE,
+   and measures its timer over TIMER_CALIBRATE back-to-back reads */
+#define SINGLE_SAMPLE   16
+#define TIMER_CALIBRATE 100000
+
+/* The environment check (-E) times ENV_PROBES runs of a fixed spin of
+   ENV_SPIN iterations */
+#define ENV_PROBES 21
+#define ENV_SPIN   1000000
+
+/* Budget eval_mm_valid runs mm's maintenance thread with (-B) */
+static int valid_maint_budget = 0;
+
+/* If set, every replay allocates with mm_calloc instead of mm_malloc (-C) */
+static int replay_calloc = 0;
+
+/* The CPU the driver is pinned to (-p), or -1, and the CPUs left for
+   the helper threads it starts */
+static int pinned_cpu = -1;
+static cpu_set_t helper_cpus;
+
 
 /********************* 
  * Function prototypes 
  *********************/
 
+/* Replays a trace on an allocator, and ranks the per-request times */
+static int replay_trace(trace_t *trace, int n, const allocator_t *alloc,
+			replay_hook_t hook, void *arg);
+static void time_request(trace_t *trace, int i, void *arg);
+static void pace_request(trace_t *trace, int i, void *arg);
+static void mm_resident_hook(trace_t *trace, int i, void *arg);
+static void libc_util_hook(trace_t *trace, int i, void *arg);
+static void rank_latency(unsigned long long *ns, int n, latency_t *lat);
+static void best_latency(latency_t *best, const latency_t *run);
+
 /* these functions manipulate range lists */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
+static int add_range_in(range_t **ranges, char *lo, int size,
+			char *heap_lo, char *heap_hi, int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void read_trace_z(trace_t *trace, FILE *tracefile, char *path);
+static void alloc_trace_arrays(trace_t *trace);
 static void free_trace(trace_t *trace);
+static trace_stream_t *open_trace_stream(char *tracedir, char *filename,
+					 trace_t *trace);
+static int next_trace_op(trace_stream_t *ts, traceop_t *op);
+static void close_trace_stream(trace_stream_t *ts);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
+static void eval_libc_util(trace_t *trace, stats_t *stats);
 static void eval_libc_speed(void *ptr);
 
+/* The null allocator, which times the driver's own replay loop */
+static void eval_null_speed(void *ptr);
+static void *null_malloc(size_t size);
+static void *null_realloc(void *ptr, size_t size);
+static void null_free(void *ptr);
+
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static void eval_mm_resident(trace_t *trace, stats_t *stats);
+static int eval_mm_single(char *filename, int tracenum, double timer,
+			  stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_compiled_speed(void *ptr);
+static void eval_mm_timed(trace_t *trace, double scale, timed_t *timed);
+static void eval_mm_latency(trace_t *trace, int n, int budget, latency_t *lat);
+static void eval_mm_faults(trace_t *trace, size_t runway, latency_t *lat,
+			   double *faults, double *prefaulted);
+static void eval_mm_pressure(trace_t *trace, int tracenum, range_t **ranges,
+			     size_t limit, pressure_t *pressure);
+static int app_cache_release(size_t size);
+
+/* Routines for comparing allocators loaded from shared objects (-D) */
+static void load_ab_lib(char *path, ab_lib_t *lib);
+static int ab_replay(ab_lib_t *lib, trace_t *trace);
+static void ab_check_hook(trace_t *trace, int i, void *arg);
+static int ab_valid(ab_lib_t *lib, trace_t *trace, int tracenum);
+static void eval_ab(trace_t *trace, int tracenum, ab_lib_t *libs, int nlibs,
+		    ab_t *ab);
 
 /* Various helper routines */
+static void count_faults(void (*f)(void *), void *arg, stats_t *stats);
+static int trace_peak(trace_t *trace, int *max_total_size);
+static size_t libc_footprint(void);
+static size_t libc_in_use(void);
+static size_t libc_resident(void);
+static void printutil(int n, stats_t *libc_stats, stats_t *mm_stats);
+static void printharness(int n, stats_t *libc_stats, stats_t *mm_stats);
+static void printcompiled(int n, stats_t *stats);
+static int is_compiled_trace(char *filename, trace_t *trace);
 static void printresults(int n, stats_t *stats);
+static void printsingle(int n, stats_t *stats, double timer);
+static double timer_cost(void);
+static void printtimed(int n, timed_t *timed, double scale);
+static void printpressure(int n, pressure_t *pressure, size_t limit);
+static void printquick(int n, quick_t *quick);
+static void printwarm(int n, warm_t *warm);
+static void printmaint(int n, maint_t *maint, int budget);
+static void printfaults(int n, fault_t *faults, size_t runway);
+static void printsbrk(int n, sbrk_t *sbrk, long cost, int backend);
+static void printcolors(int n, color_t *colors, stats_t *stats,
+			uintptr_t base, size_t step);
+static void printab(int n, ab_t *ab, ab_lib_t *libs, int nlibs);
+static void pin_cpu(int cpu);
+static void helper_affinity(int on);
+static int start_maintenance(int budget);
+static int start_runway(size_t bytes);
+static int check_env(double precision);
+static int read_sysfs(char *path, char *buf, int len);
+static unsigned long long now_ns(void);
+static int cmp_ull(const void *a, const void *b);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
+static void *replay_malloc(size_t size);
 
 /**************
  * Main routine
@@ -146,10 +471,44 @@ int main(int argc, char **argv)
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    timed_t *mm_timed = NULL;  /* mm paced replay results for each trace */
+    pressure_t *mm_pressure = NULL; /* mm results under a heap cap */
+    quick_t *mm_quick = NULL;  /* mm utilization with and without quick classes */
+    warm_t *mm_warm = NULL;    /* mm warmup from a cold and a warm start */
+    maint_t *mm_maint = NULL;  /* mm latency with inline and background upkeep */
+    fault_t *mm_faults = NULL; /* page faults with and without a runway */
+    sbrk_t *mm_sbrk = NULL;    /* heap growth calls and their cost */
+    color_t *mm_colors = NULL; /* throughput at a sweep of heap offsets */
+    ab_t *ab = NULL;           /* interleaved runs of the -D libraries */
+    ab_lib_t ab_libs[AB_MAX_LIBS]; /* the -D libraries */
+    int num_ab_libs = 0;
+    int pin = -1;            /* If set, run on this CPU only (-p) */
+    double precision = 0;    /* If set, refuse noisier machines (-E) */
+    int single_pass = 0;     /* If set, check, measure and time at once (-s) */
+    double timer = 0;        /* ns one per-request timing adds (-s) */
+    unsigned long sbrk_calls;  /* mem_sbrk_stats after a replay */
+    unsigned long long sbrk_ns;
+    mm_stats_t mm_counters;    /* mm's own counters after a run */
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    double replay_scale = 0; /* If set, replay timed traces paced (-T) */
+    size_t heap_limit = 0;   /* If set, also replay with the heap capped (-M) */
+    int quick_report = 0;    /* If set, report what quick classes gain (-q) */
+    int warm_report = 0;     /* If set, compare cold and warm starts (-w) */
+    int maint_budget = 0;    /* If set, run mm's maintenance thread (-B) */
+    size_t runway = 0;       /* If set, compare faults with a runway (-P) */
+    int heap_backend = MEM_SIMULATED; /* storage behind mm's heap (-H) */
+    long sbrk_cost = 0;      /* If set, charge every mem_sbrk this (-S) */
+    int populate = 0;        /* If set, fault in all of the heap first (-F) */
+    uintptr_t heap_base = 0; /* If set, map the heap at this address (-A) */
+    size_t heap_color = 0;   /* and start it this many bytes in */
+    size_t color_step = 0;   /* If set, sweep heap offsets by this (-O) */
+    int calibrate = 0;       /* If set, time the harness alone too (-N) */
+    int compiled = 0;        /* If set, time the compiled trace too (-c) */
+    char *end;
+    int k;
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,8 +517,26 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:T:M:B:P:H:S:A:O:D:p:E:hvVgalqwCFNcs")) != EOF) {
         switch (c) {
+	case 'C': /* Allocate with mm_calloc in every replay */
+	    replay_calloc = 1;
+	    break;
+	case 'F': /* Fault in all of mm's heap before the replays */
+	    populate = 1;
+	    break;
+	case 'N': /* Time each trace on the null allocator too */
+	    calibrate = 1;
+	    break;
+	case 's': /* Check, measure and time each trace in one replay */
+	    single_pass = 1;
+	    break;
+	case 'c': /* Time the trace compiled in by "make compiled" too */
+	    if (mm_compiled_replay == NULL)
+		app_error("No compiled trace; build mdriver-compiled with "
+			  "\"make compiled TRACE=<file>\"");
+	    compiled = 1;
+	    break;
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
@@ -184,6 +561,98 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+	case 'q': /* Measure utilization with quick classes off as well */
+	    quick_report = 1;
+	    break;
+	case 'w': /* Replay the start of each trace warmed from a profile */
+	    warm_report = 1;
+	    break;
+	case 'M': /* Replay again with the heap capped at optarg KB */
+	    heap_limit = (size_t)atoi(optarg) * 1024;
+	    if (heap_limit == 0 || heap_limit > MAX_HEAP) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'B': /* Compare maintenance inline and on a thread at optarg% */
+	    maint_budget = atoi(optarg);
+	    if (maint_budget < 1 || maint_budget > 100) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'P': /* Compare page faults with an optarg KB runway */
+	    runway = (size_t)atoi(optarg) * 1024;
+	    if (runway == 0 || runway > MAX_HEAP) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'H': /* Put mm's heap in the storage named by optarg */
+	    if (!strcmp(optarg, "sim"))
+		heap_backend = MEM_SIMULATED;
+	    else if (!strcmp(optarg, "brk"))
+		heap_backend = MEM_BRK;
+	    else if (!strcmp(optarg, "mmap"))
+		heap_backend = MEM_MMAP;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'S': /* Charge every mem_sbrk optarg ns, or a real syscall */
+	    if (!strcmp(optarg, "sys"))
+		sbrk_cost = MEM_SBRK_SYSCALL;
+	    else if ((sbrk_cost = atol(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'A': /* Map the heap at optarg's address[:offset] */
+	    heap_base = (uintptr_t)strtoul(optarg, &end, 0);
+	    if (*end == ':')
+		heap_color = (size_t)strtoul(end + 1, &end, 0);
+	    if (heap_base == 0 || *end != '\0' ||
+		heap_color % ALIGNMENT != 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'O': /* Sweep the heap's offset in steps of optarg bytes */
+	    color_step = (size_t)atoi(optarg);
+	    if (color_step == 0 || color_step % ALIGNMENT != 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'D': /* Compare the allocator in shared object optarg */
+	    if (num_ab_libs == AB_MAX_LIBS) {
+		usage();
+		exit(1);
+	    }
+	    ab_libs[num_ab_libs++].path = optarg;
+	    break;
+	case 'p': /* Pin the driver to CPU optarg */
+	    pin = atoi(optarg);
+	    if (pin < 0 || pin >= CPU_SETSIZE) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'E': /* Check the machine, refusing noise over optarg percent */
+	    precision = atof(optarg);
+	    if (precision <= 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'T': /* Replay timed traces with their gaps scaled by optarg */
+	    replay_scale = atof(optarg);
+	    if (replay_scale <= 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -235,6 +704,12 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* Pin the driver, then make sure the machine is quiet enough */
+    if (pin >= 0)
+	pin_cpu(pin);
+    if (precision > 0 && check_env(precision) < 0)
+	exit(1);
+
     /* Initialize the timing package */
     init_fsecs();
 
@@ -258,10 +733,15 @@ int main(int argc, char **argv)
 		printf("Checking libc malloc for correctness, ");
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
 	    if (libc_stats[i].valid) {
+		eval_libc_util(trace, &libc_stats[i]);
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
+		count_faults(eval_libc_speed, &speed_params, &libc_stats[i]);
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		if (calibrate)
+		    libc_stats[i].harness_secs = fsecs(eval_null_speed,
+						       &speed_params);
 	    }
 	    free_trace(trace);
 	}
@@ -283,12 +763,82 @@ int main(int argc, char **argv)
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
+    if (replay_scale > 0 &&
+	(mm_timed = (timed_t *)calloc(num_tracefiles, sizeof(timed_t))) == NULL)
+	unix_error("mm_timed calloc in main failed");
+    if (heap_limit > 0 &&
+	(mm_pressure = (pressure_t *)calloc(num_tracefiles,
+					    sizeof(pressure_t))) == NULL)
+	unix_error("mm_pressure calloc in main failed");
+    if (quick_report &&
+	(mm_quick = (quick_t *)calloc(num_tracefiles, sizeof(quick_t))) == NULL)
+	unix_error("mm_quick calloc in main failed");
+    if (warm_report &&
+	(mm_warm = (warm_t *)calloc(num_tracefiles, sizeof(warm_t))) == NULL)
+	unix_error("mm_warm calloc in main failed");
+    if (maint_budget > 0 &&
+	(mm_maint = (maint_t *)calloc(num_tracefiles, sizeof(maint_t))) == NULL)
+	unix_error("mm_maint calloc in main failed");
+    if (runway > 0 &&
+	(mm_faults = (fault_t *)calloc(num_tracefiles, sizeof(fault_t))) == NULL)
+	unix_error("mm_faults calloc in main failed");
+    if ((sbrk_cost != 0 || heap_backend == MEM_BRK) &&
+	(mm_sbrk = (sbrk_t *)calloc(num_tracefiles, sizeof(sbrk_t))) == NULL)
+	unix_error("mm_sbrk calloc in main failed");
+    if (color_step > 0 &&
+	(mm_colors = (color_t *)calloc(num_tracefiles, sizeof(color_t))) == NULL)
+	unix_error("mm_colors calloc in main failed");
+    if (num_ab_libs == 1)
+	app_error("-D needs at least two shared objects to compare");
+    if (single_pass && autograder)
+	app_error("-s has no perf index to grade; leave out -g");
+    if (num_ab_libs > 0) {
+	if ((ab = (ab_t *)calloc(num_tracefiles, sizeof(ab_t))) == NULL)
+	    unix_error("ab calloc in main failed");
+	for (k = 0; k < num_ab_libs; k++)
+	    load_ab_lib(ab_libs[k].path, &ab_libs[k]);
+    }
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
+    if (heap_backend != MEM_SIMULATED) {
+	i = mem_set_backend(heap_backend);
+	if (i < 0)
+	    app_error("mem_set_backend failed in main");
+	if (i != heap_backend)
+	    printf("The brk can't be moved here; mm's heap is in a private "
+		   "mapping instead.\n");
+	else
+	    printf("mm's heap is in %s.\n", i == MEM_BRK ?
+		   "the process's program break" : "a private mapping");
+	if (i == MEM_BRK && runway > 0) {
+	    printf("No runway past the real brk; -P ignored.\n");
+	    runway = 0;
+	}
+    }
+    if (heap_base != 0) {
+	if (mem_set_base((void *)heap_base, heap_color) < 0)
+	    app_error("mem_set_base can't map the heap at the -A address");
+	printf("mm's heap is mapped at %#lx, %lu bytes in.\n",
+	       (unsigned long)heap_base, (unsigned long)heap_color);
+	heap_backend = MEM_MMAP;
+    }
+    mem_set_sbrk_cost(sbrk_cost);
+    if (populate && mem_populate() < 0) {
+	printf("The real brk can't be faulted in ahead; -F ignored.\n");
+	populate = 0;
+    }
+
+    /* With -s, each trace is streamed through mm exactly once */
+    if (single_pass) {
+	timer = timer_cost();
+	for (i=0; i < num_tracefiles; i++)
+	    mm_stats[i].valid = eval_mm_single(tracefiles[i], i, timer,
+					       &mm_stats[i]);
+    }
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
+    for (i=0; !single_pass && i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
 	mm_stats[i].ops = trace->num_ops;
 	if (verbose > 1)
@@ -298,11 +848,138 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("efficiency, ");
 	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    mem_sbrk_stats(&sbrk_calls, &sbrk_ns);
+	    eval_mm_resident(trace, &mm_stats[i]);
+	    if (populate)
+		mem_populate();
+	    if (warm_report) {
+		/* A cold run with quick classes is the profile for the warm start */
+		mm_set_quick_classes(MM_QUICK_MAX);
+		mm_warm[i].util_cold = eval_mm_util(trace, i, &ranges);
+		mm_get_stats(&mm_counters);
+		mm_warm[i].classes = mm_counters.nquick;
+		eval_mm_latency(trace, WARMUP_OPS, 0, &mm_warm[i].cold);
+		mm_set_warm_profile(&mm_counters);
+		mm_warm[i].valid = eval_mm_valid(trace, i, &ranges);
+		if (mm_warm[i].valid) {
+		    mm_warm[i].util_warm = eval_mm_util(trace, i, &ranges);
+		    eval_mm_latency(trace, WARMUP_OPS, 0, &mm_warm[i].warm);
+		}
+		mm_set_warm_profile(NULL);
+		mm_set_quick_classes(0);
+	    }
+	    if (quick_report) {
+		if (verbose > 1)
+		    printf("Checking with quick classes on.\n");
+		mm_set_quick_classes(MM_QUICK_MAX);
+		mm_quick[i].util_off = mm_stats[i].util;
+		mm_quick[i].valid = eval_mm_valid(trace, i, &ranges);
+		if (mm_quick[i].valid) {
+		    mm_quick[i].util_on = eval_mm_util(trace, i, &ranges);
+		    mm_get_stats(&mm_counters);
+		    mm_quick[i].hits = mm_counters.quick_hits;
+		    mm_quick[i].added = mm_counters.quick_added;
+		    mm_quick[i].retired = mm_counters.quick_retired;
+		}
+		mm_set_quick_classes(0);
+	    }
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
+	    count_faults(eval_mm_speed, &speed_params, &mm_stats[i]);
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (calibrate)
+		mm_stats[i].harness_secs = fsecs(eval_null_speed, &speed_params);
+	    if (compiled && is_compiled_trace(tracefiles[i], trace)) {
+		if (verbose > 1)
+		    printf("Timing the compiled trace.\n");
+		mm_stats[i].compiled_secs = fsecs(eval_compiled_speed, NULL);
+	    }
+	    if (color_step > 0) {
+		if (verbose > 1)
+		    printf("Sweeping the heap's offset.\n");
+		mm_colors[i].valid = 1;
+		for (k = 0; k < COLOR_STEPS; k++) {
+		    if (mem_set_base((void *)(heap_base ? heap_base : HEAP_BASE),
+				     k * color_step) < 0)
+			continue;
+		    if (populate)
+			mem_populate();
+		    mm_colors[i].secs[k] = fsecs(eval_mm_speed, &speed_params);
+		}
+		/* put the heap back where the other replays expect it */
+		if (heap_base != 0)
+		    mem_set_base((void *)heap_base, heap_color);
+		else
+		    mem_set_backend(heap_backend);
+		if (populate)
+		    mem_populate();
+	    }
+	    if (mm_sbrk != NULL) {
+		mm_sbrk[i].valid = 1;
+		mm_sbrk[i].calls = sbrk_calls;
+		mm_sbrk[i].usecs = sbrk_ns / 1e3;
+		mm_sbrk[i].secs = mm_stats[i].secs;
+	    }
+	    if (replay_scale > 0 && trace->stamps != NULL) {
+		if (verbose > 1)
+		    printf("Replaying with the captured request gaps.\n");
+		/* mm_idle's work is trimming quick lists */
+		mm_set_quick_classes(MM_QUICK_MAX);
+		eval_mm_timed(trace, replay_scale, &mm_timed[i]);
+		mm_set_quick_classes(0);
+	    }
+	    if (maint_budget > 0) {
+		if (verbose > 1)
+		    printf("Replaying with mm's maintenance thread.\n");
+		/* Quick classes are most of the upkeep there is to hand off */
+		mm_set_quick_classes(MM_QUICK_MAX);
+		valid_maint_budget = maint_budget;
+		mm_maint[i].valid = eval_mm_valid(trace, i, &ranges);
+		valid_maint_budget = 0;
+		if (mm_maint[i].valid) {
+		    eval_mm_latency(trace, trace->num_ops, 0,
+				    &mm_maint[i].inline_lat);
+		    eval_mm_latency(trace, trace->num_ops, maint_budget,
+				    &mm_maint[i].bg_lat);
+		    mm_get_stats(&mm_counters);
+		    mm_maint[i].steps = mm_counters.maint_steps;
+		    mm_maint[i].usecs = mm_counters.maint_usecs;
+		    mm_maint[i].pooled = mm_counters.calloc_pooled;
+		}
+		mm_set_quick_classes(0);
+	    }
+	    if (runway > 0) {
+		if (verbose > 1)
+		    printf("Replaying with a runway of faulted-in pages.\n");
+		mem_reset_brk();
+		mem_discard();
+		if (start_runway(runway) < 0)
+		    app_error("mem_set_runway failed in main");
+		mm_faults[i].valid = eval_mm_valid(trace, i, &ranges);
+		mem_set_runway(0);
+		if (mm_faults[i].valid) {
+		    eval_mm_faults(trace, 0, &mm_faults[i].off,
+				   &mm_faults[i].faults_off, NULL);
+		    eval_mm_faults(trace, runway, &mm_faults[i].on,
+				   &mm_faults[i].faults_on,
+				   &mm_faults[i].prefaulted);
+		}
+		if (populate)
+		    mem_populate();
+	    }
+	    if (heap_limit > 0) {
+		if (verbose > 1)
+		    printf("Replaying with the heap capped.\n");
+		eval_mm_pressure(trace, i, &ranges, heap_limit,
+				 &mm_pressure[i]);
+	    }
+	}
+	if (num_ab_libs > 0) {
+	    if (verbose > 1)
+		printf("Timing the -D libraries interleaved.\n");
+	    eval_ab(trace, i, ab_libs, num_ab_libs, &ab[i]);
 	}
 	free_trace(trace);
     }
@@ -310,7 +987,59 @@ int main(int argc, char **argv)
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
+	if (single_pass)
+	    printsingle(num_tracefiles, mm_stats, timer);
+	else
+	    printresults(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (run_libc) {
+	printutil(num_tracefiles, libc_stats, mm_stats);
+	printf("\n");
+    }
+    if (calibrate) {
+	printharness(num_tracefiles, libc_stats, mm_stats);
+	printf("\n");
+    }
+    if (compiled) {
+	printcompiled(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (replay_scale > 0) {
+	printtimed(num_tracefiles, mm_timed, replay_scale);
+	printf("\n");
+    }
+    if (heap_limit > 0) {
+	printpressure(num_tracefiles, mm_pressure, heap_limit);
+	printf("\n");
+    }
+    if (quick_report) {
+	printquick(num_tracefiles, mm_quick);
+	printf("\n");
+    }
+    if (warm_report) {
+	printwarm(num_tracefiles, mm_warm);
+	printf("\n");
+    }
+    if (maint_budget > 0) {
+	printmaint(num_tracefiles, mm_maint, maint_budget);
+	printf("\n");
+    }
+    if (runway > 0) {
+	printfaults(num_tracefiles, mm_faults, runway);
+	printf("\n");
+    }
+    if (mm_sbrk != NULL) {
+	printsbrk(num_tracefiles, mm_sbrk, sbrk_cost, heap_backend);
+	printf("\n");
+    }
+    if (color_step > 0) {
+	printcolors(num_tracefiles, mm_colors, mm_stats,
+		    heap_base ? heap_base : HEAP_BASE, color_step);
+	printf("\n");
+    }
+    if (num_ab_libs > 0) {
+	printab(num_tracefiles, ab, ab_libs, num_ab_libs);
 	printf("\n");
     }
 
@@ -346,10 +1075,16 @@ int main(int argc, char **argv)
 	}
 	
 	perfindex = (p1 + p2)*100.0;
-	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
-	       p1*100, 
-	       p2*100, 
-	       perfindex);
+	if (single_pass)
+	    /* one cold pass timed call by call, not the K-best times */
+	    printf("Single-pass index = %.0f (util) + %.0f (thru) = %.0f/100"
+		   " (not comparable to the perf index)\n",
+		   p1*100, p2*100, perfindex);
+	else
+	    printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
+		   p1*100, 
+		   p2*100, 
+		   perfindex);
 	
     }
     else { /* There were errors */
@@ -380,6 +1115,17 @@ int main(int argc, char **argv)
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
+{
+    return add_range_in(ranges, lo, size, (char *)mem_heap_lo(),
+			(char *)mem_heap_hi(), tracenum, opnum);
+}
+
+/*
+ * add_range_in - add_range for a payload that must lie between heap_lo
+ *     and heap_hi rather than in mm's heap
+ */
+static int add_range_in(range_t **ranges, char *lo, int size,
+			char *heap_lo, char *heap_hi, int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
     range_t *p;
@@ -396,10 +1142,10 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    if ((lo < heap_lo) || (lo > heap_hi) || 
+	(hi < heap_lo) || (hi > heap_hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
-		lo, hi, mem_heap_lo(), mem_heap_hi());
+		lo, hi, heap_lo, heap_hi);
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
@@ -477,9 +1223,12 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
+    char line[MAXLINE];
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
+    unsigned long long stamp;
+    int timed = 0;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -495,47 +1244,44 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+
+    /* Compressed tracefiles are recognized by their magic number */
+    if (tz_is_compressed(tracefile)) {
+	read_trace_z(trace, tracefile, path);
+	fclose(tracefile);
+	return trace;
+    }
+
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
     fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
+    alloc_trace_arrays(trace);
     
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
+    while (fgets(line, MAXLINE, tracefile) != NULL) {
+	if (sscanf(line, "%s", type) != 1)
+	    continue; /* blank line */
+	stamp = 0;
 	switch(type[0]) {
 	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	    timed = sscanf(line, "%*s %u %u %llu", &index, &size, &stamp) == 3;
 	    trace->ops[op_index].type = ALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	    timed = sscanf(line, "%*s %u %u %llu", &index, &size, &stamp) == 3;
 	    trace->ops[op_index].type = REALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'f':
-	    fscanf(tracefile, "%ud", &index);
+	    timed = sscanf(line, "%*s %u %llu", &index, &stamp) == 2;
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
@@ -544,6 +1290,19 @@ static trace_t *read_trace(char *tracedir, char *filename)
 		   type[0], path);
 	    exit(1);
 	}
+
+	/* The optional last column is the capture time in ns */
+	if (op_index == 0 && timed &&
+	    (trace->stamps = (unsigned long long *)
+	     malloc(trace->num_ops * sizeof(unsigned long long))) == NULL)
+	    unix_error("malloc 5 failed in read_trace");
+	if ((trace->stamps != NULL) != timed) {
+	    sprintf(msg, "Timestamps in %s must be given for all requests "
+		    "or none", path);
+	    app_error(msg);
+	}
+	if (timed)
+	    trace->stamps[op_index] = stamp;
 	op_index++;
 	
     }
@@ -555,7 +1314,84 @@ static trace_t *read_trace(char *tracedir, char *filename)
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
+ * alloc_trace_arrays - Allocate the per-request and per-block arrays
+ *     once the trace header has been read
+ */
+static void alloc_trace_arrays(trace_t *trace)
+{
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in read_trace");
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+
+    /* Timestamps are optional, and allocated when the first one is seen */
+    trace->stamps = NULL;
+}
+
+/*
+ * read_trace_z - read a compressed tracefile (see tracez.c), decoding
+ *     it one block at a time straight into trace->ops
+ */
+static void read_trace_z(trace_t *trace, FILE *tracefile, char *path)
+{
+    tz_header_t hdr;
+    tz_reader_t *reader;
+    tz_op_t ops[TZ_BLOCK_OPS];
+    traceop_t *op;
+    unsigned max_index = 0;
+    int op_index = 0;
+    int i, n;
+
+    if ((reader = tz_reader_open(tracefile, &hdr)) == NULL) {
+	sprintf(msg, "Bad header in compressed tracefile %s", path);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = hdr.sugg_heapsize;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->weight = hdr.weight;
+    alloc_trace_arrays(trace);
+    if (hdr.timed && (trace->stamps = (unsigned long long *)
+		      malloc(trace->num_ops * sizeof(unsigned long long))) == NULL)
+	unix_error("malloc 5 failed in read_trace_z");
+
+    while ((n = tz_read_block(reader, ops)) > 0) {
+	if (op_index + n > trace->num_ops)
+	    break;
+	for (i = 0; i < n; i++) {
+	    op = &trace->ops[op_index++];
+	    op->type = (ops[i].type == TZ_ALLOC) ? ALLOC :
+		(ops[i].type == TZ_REALLOC) ? REALLOC : FREE;
+	    op->index = ops[i].index;
+	    op->size = ops[i].size;
+	    if (trace->stamps != NULL)
+		trace->stamps[op_index - 1] = ops[i].stamp;
+	    if (op->type != FREE && ops[i].index > max_index)
+		max_index = ops[i].index;
+	}
+    }
+    if (n != 0) {
+	sprintf(msg, "Corrupt block in compressed tracefile %s", path);
+	app_error(msg);
+    }
+    tz_reader_close(reader);
+
+    assert(max_index == trace->num_ids - 1);
+    assert(trace->num_ops == op_index);
+}
+
+/*
+ * free_trace - Free the trace record and the arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
@@ -563,14 +1399,227 @@ void free_trace(trace_t *trace)
     free(trace->ops);         /* free the three arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->stamps);
     free(trace);              /* and the trace record itself... */
 }
 
+/*
+ * open_trace_stream - Open a tracefile to be read one request at a
+ *     time. Fills in trace's header fields and its block arrays; the
+ *     requests themselves are never held in memory.
+ */
+static trace_stream_t *open_trace_stream(char *tracedir, char *filename,
+					 trace_t *trace)
+{
+    trace_stream_t *ts;
+    tz_header_t hdr;
+    char path[MAXLINE];
+
+    if ((ts = (trace_stream_t *)malloc(sizeof(trace_stream_t))) == NULL)
+	unix_error("malloc failed in open_trace_stream");
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((ts->fp = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in open_trace_stream", path);
+	unix_error(msg);
+    }
+    ts->path = strdup(path);
+    ts->reader = NULL;
+    ts->n = ts->next = 0;
+
+    if (tz_is_compressed(ts->fp)) {
+	if ((ts->reader = tz_reader_open(ts->fp, &hdr)) == NULL) {
+	    sprintf(msg, "Bad header in compressed tracefile %s", path);
+	    app_error(msg);
+	}
+	trace->sugg_heapsize = hdr.sugg_heapsize;
+	trace->num_ids = hdr.num_ids;
+	trace->num_ops = hdr.num_ops;
+	trace->weight = hdr.weight;
+    } else if (fscanf(ts->fp, "%d %d %d %d", &trace->sugg_heapsize,
+		      &trace->num_ids, &trace->num_ops, &trace->weight) != 4) {
+	sprintf(msg, "Bad header in tracefile %s", path);
+	app_error(msg);
+    }
+
+    trace->ops = NULL;
+    trace->stamps = NULL;
+    if ((trace->blocks = (char **)malloc(trace->num_ids * sizeof(char *)))
+	== NULL ||
+	(trace->block_sizes = (size_t *)malloc(trace->num_ids *
+					       sizeof(size_t))) == NULL)
+	unix_error("malloc failed in open_trace_stream");
+    return ts;
+}
+
+/*
+ * next_trace_op - Read the next request of a trace stream. Returns 0
+ *     at the end of the trace. Timestamps are skipped.
+ */
+static int next_trace_op(trace_stream_t *ts, traceop_t *op)
+{
+    char line[MAXLINE];
+    char type[MAXLINE];
+    unsigned index, size = 0;
+    tz_op_t *z;
+    int ok;
+
+    if (ts->reader != NULL) {
+	if (ts->next == ts->n) {
+	    if ((ts->n = tz_read_block(ts->reader, ts->ops)) == 0)
+		return 0;
+	    if (ts->n < 0) {
+		sprintf(msg, "Corrupt block in compressed tracefile %s",
+			ts->path);
+		app_error(msg);
+	    }
+	    ts->next = 0;
+	}
+	z = &ts->ops[ts->next++];
+	op->type = (z->type == TZ_ALLOC) ? ALLOC :
+	    (z->type == TZ_REALLOC) ? REALLOC : FREE;
+	op->index = z->index;
+	op->size = z->size;
+	return 1;
+    }
+
+    do {
+	if (fgets(line, MAXLINE, ts->fp) == NULL)
+	    return 0;
+    } while (sscanf(line, "%s", type) != 1);
+    switch (type[0]) {
+    case 'a':
+	op->type = ALLOC;
+	ok = sscanf(line, "%*s %u %u", &index, &size) == 2;
+	break;
+    case 'r':
+	op->type = REALLOC;
+	ok = sscanf(line, "%*s %u %u", &index, &size) == 2;
+	break;
+    case 'f':
+	op->type = FREE;
+	ok = sscanf(line, "%*s %u", &index) == 1;
+	break;
+    default:
+	ok = 0;
+    }
+    if (!ok) {
+	printf("Bogus request in tracefile %s: %s", ts->path, line);
+	exit(1);
+    }
+    op->index = index;
+    op->size = size;
+    return 1;
+}
+
+/*
+ * close_trace_stream - Close a trace stream and free its buffers
+ */
+static void close_trace_stream(trace_stream_t *ts)
+{
+    if (ts->reader != NULL)
+	tz_reader_close(ts->reader);
+    fclose(ts->fp);
+    free(ts->path);
+    free(ts);
+}
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/* The allocators traces are replayed on */
+static const allocator_t mm_allocator = { replay_malloc, mm_realloc, mm_free };
+static const allocator_t libc_allocator = { malloc, realloc, free };
+static const allocator_t null_allocator = { null_malloc, null_realloc,
+					    null_free };
+
+/*
+ * replay_trace - Replay the first n requests of a trace on alloc, with
+ *    the blocks kept in the trace's blocks array. After each request,
+ *    hook (unless NULL) is called with its index and arg. Returns the
+ *    number of requests replayed, short of n only if a malloc or
+ *    realloc returned NULL.
+ */
+static int replay_trace(trace_t *trace, int n, const allocator_t *alloc,
+			replay_hook_t hook, void *arg)
+{
+    int i, index;
+    char *p;
+
+    for (i = 0;  i < n;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC:
+            if ((p = alloc->malloc_fn(trace->ops[i].size)) == NULL)
+		return i;
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC:
+            if ((p = alloc->realloc_fn(trace->blocks[index],
+				       trace->ops[i].size)) == NULL)
+		return i;
+            trace->blocks[index] = p;
+            break;
+
+        case FREE:
+            alloc->free_fn(trace->blocks[index]);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in replay_trace");
+        }
+	if (hook != NULL)
+	    hook(trace, i, arg);
+    }
+    return n;
+}
+
+/*
+ * time_request - replay_trace hook that times each request, from the
+ *    end of the one before (or from start, for the first)
+ */
+static void time_request(trace_t *trace, int i, void *arg)
+{
+    timing_t *t = (timing_t *)arg;
+    unsigned long long now = now_ns();
+
+    t->ns[i] = now - t->start;
+    t->start = now;
+}
+
+/*
+ * rank_latency - Sort n per-request times in ns and summarize them,
+ *    in usecs, in lat
+ */
+static void rank_latency(unsigned long long *ns, int n, latency_t *lat)
+{
+    qsort(ns, n, sizeof(unsigned long long), cmp_ull);
+    lat->p50 = ns[(n - 1) / 2] / 1e3;
+    lat->p99 = ns[(int)((n - 1) * 0.99)] / 1e3;
+    lat->p999 = ns[(int)((n - 1) * 0.999)] / 1e3;
+    lat->max = ns[n - 1] / 1e3;
+}
+
+/*
+ * best_latency - Lower each statistic in best to run's where run's is
+ *    lower, for the K-best scheme
+ */
+static void best_latency(latency_t *best, const latency_t *run)
+{
+    if (run->p50 < best->p50)
+	best->p50 = run->p50;
+    if (run->p99 < best->p99)
+	best->p99 = run->p99;
+    if (run->p999 < best->p999)
+	best->p999 = run->p999;
+    if (run->max < best->max)
+	best->max = run->max;
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -594,6 +1643,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	return 0;
     }
 
+    /* With -B, check mm with its maintenance thread running as well */
+    if (valid_maint_budget > 0 && start_maintenance(valid_maint_budget) < 0)
+	app_error("mm_start_maintenance failed in eval_mm_valid");
+
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
 	index = trace->ops[i].index;
@@ -604,7 +1657,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = replay_malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -616,6 +1669,14 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
 		return 0;
+
+	    /* With -C, the block must come back cleared */
+	    for (j = 0; replay_calloc && j < size; j++) {
+		if (p[j] != 0) {
+		    malloc_error(tracenum, i, "mm_calloc returned a block that isn't zeroed.");
+		    return 0;
+		}
+	    }
 	    
 	    /* ADDED: cgw
 	     * fill range with low byte of index.  This will be used later
@@ -679,6 +1740,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         }
 
     }
+    mm_stop_maintenance();
 
     /* As far as we know, this is a valid malloc package */
     return 1;
@@ -697,86 +1759,229 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
-    int i;
-    int index;
-    int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
-    char *p;
-    char *newp, *oldp;
+    int max_total_size;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    if (replay_trace(trace, trace->num_ops, &mm_allocator, NULL, NULL) <
+	trace->num_ops)
+	app_error("mm_malloc or mm_realloc failed in eval_mm_util");
 
-        case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+    trace_peak(trace, &max_total_size);
+    return ((double)max_total_size / (double)mem_heapsize());
+}
 
-	    if ((p = mm_malloc(size)) == NULL) 
-		app_error("mm_malloc failed in eval_mm_util");
-	    
-	    /* Remember region and size */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
-	    
-	    /* Keep track of current total size
-	     * of all allocated blocks */
-	    total_size += size;
-	    
-	    /* Update statistics */
-	    max_total_size = (total_size > max_total_size) ?
-		total_size : max_total_size;
-	    break;
 
-	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldsize = trace->block_sizes[index];
+/*
+ * mm_resident_hook - replay_trace hook of eval_mm_resident: fills the
+ *   payload of each block handed out, as eval_mm_valid does, and
+ *   samples mem_resident() after the peak request
+ */
+static void mm_resident_hook(trace_t *trace, int i, void *arg)
+{
+    resident_t *r = (resident_t *)arg;
+    int index = trace->ops[i].index;
+    size_t resident;
+
+    if (trace->ops[i].type != FREE)
+	memset(trace->blocks[index], index & 0xFF, trace->ops[i].size);
+    if (i == r->peak_op && (resident = mem_resident()) > 0)
+	r->stats->rss_util = (double)r->max_total_size / resident;
+}
 
-	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
-		app_error("mm_realloc failed in eval_mm_util");
+/*
+ * eval_mm_resident - Measure utilization by residency rather than brk.
+ *   The trace is replayed on freshly discarded pages, so that only the
+ *   pages mm and the payloads touched count, and mem_resident() is
+ *   sampled right after the request that takes live bytes to their
+ *   peak, and at the end. Payloads are written, as an application
+ *   would, so every live byte is resident and rss can't exceed 100%.
+ */
+static void eval_mm_resident(trace_t *trace, stats_t *stats)
+{
+    resident_t r;
 
-	    /* Remember region and size */
-	    trace->blocks[index] = newp;
-	    trace->block_sizes[index] = newsize;
-	    
-	    /* Keep track of current total size
-	     * of all allocated blocks */
-	    total_size += (newsize - oldsize);
-	    
-	    /* Update statistics */
-	    max_total_size = (total_size > max_total_size) ?
-		total_size : max_total_size;
+    r.peak_op = trace_peak(trace, &r.max_total_size);
+    r.stats = stats;
+    mem_reset_brk();
+    mem_discard();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_resident");
+    stats->rss_util = 0;
+    if (replay_trace(trace, trace->num_ops, &mm_allocator,
+		     mm_resident_hook, &r) < trace->num_ops)
+	app_error("mm_malloc or mm_realloc failed in eval_mm_resident");
+    stats->rss_end = mem_resident();
+}
+
+/*
+ * eval_mm_single - Check, measure and time mm in a single replay of a
+ *     trace streamed from its file (-s), for traces too big to replay
+ *     a dozen times or to hold in memory.
+ *
+ *     Each mm call is timed on its own with now_ns(), and the time one
+ *     timing adds (timer, from timer_cost()) is taken back out, so the
+ *     parsing and checking between calls don't count. Every block is
+ *     checked for alignment and for lying inside the heap; only blocks
+ *     of one id in SINGLE_SAMPLE are filled and checked for overwrites
+ *     and realloc copies, in place of the full range list. Utilization
+ *     is computed as in eval_mm_util. Returns 0 if mm got something wrong.
+ */
+static int eval_mm_single(char *filename, int tracenum, double timer,
+			  stats_t *stats)
+{
+    trace_t trace;
+    trace_stream_t *ts;
+    traceop_t op;
+    char *p, *oldp;
+    size_t j, size, oldsize;
+    double total_size = 0, max_total_size = 0;
+    unsigned long long start, mm_ns = 0, t0;
+    int i, sampled, ok = 0;
+
+    if (verbose > 1)
+	printf("Checking, measuring and timing mm in one pass over %s.\n",
+	       filename);
+    ts = open_trace_stream(tracedir, filename, &trace);
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	goto out;
+    }
+
+    t0 = now_ns();
+    for (i = 0; next_trace_op(ts, &op); i++) {
+	if (op.index < 0 || op.index >= trace.num_ids)
+	    app_error("Block id out of range in eval_mm_single");
+	size = op.size;
+	sampled = op.index % SINGLE_SAMPLE == 0;
+
+	switch (op.type) {
+	case ALLOC:
+	    start = now_ns();
+	    p = replay_malloc(size);
+	    mm_ns += now_ns() - start;
+	    if (p == NULL) {
+		malloc_error(tracenum, i, "mm_malloc failed.");
+		goto out;
+	    }
+	    oldsize = 0;
 	    break;
 
-        case FREE: /* mm_free */
-	    index = trace->ops[i].index;
-	    size = trace->block_sizes[index];
-	    p = trace->blocks[index];
-	    
-	    mm_free(p);
-	    
-	    /* Keep track of current total size
-	     * of all allocated blocks */
-	    total_size -= size;
-	    
+	case REALLOC:
+	    oldp = trace.blocks[op.index];
+	    start = now_ns();
+	    p = mm_realloc(oldp, size);
+	    mm_ns += now_ns() - start;
+	    if (p == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		goto out;
+	    }
+	    oldsize = trace.block_sizes[op.index];
+	    for (j = 0; sampled && j < size && j < oldsize; j++)
+		if (p[j] != (char)(op.index & 0xFF)) {
+		    malloc_error(tracenum, i, "mm_realloc did not preserve "
+				 "the data from old block");
+		    goto out;
+		}
 	    break;
 
-	default:
-	    app_error("Nonexistent request type in eval_mm_util");
+	default: /* FREE */
+	    p = trace.blocks[op.index];
+	    for (j = 0; sampled && j < trace.block_sizes[op.index]; j++)
+		if (p[j] != (char)(op.index & 0xFF)) {
+		    malloc_error(tracenum, i, "Payload was overwritten while "
+				 "allocated");
+		    goto out;
+		}
+	    start = now_ns();
+	    mm_free(p);
+	    mm_ns += now_ns() - start;
+	    total_size -= trace.block_sizes[op.index];
+	    continue;
+	}
 
-        }
+	/* The payload must be aligned and lie within the heap */
+	if (!IS_ALIGNED(p)) {
+	    sprintf(msg, "Payload address (%p) not aligned to %d bytes",
+		    p, ALIGNMENT);
+	    malloc_error(tracenum, i, msg);
+	    goto out;
+	}
+	if (size > 0 && (p < (char *)mem_heap_lo() ||
+			 p + size - 1 > (char *)mem_heap_hi())) {
+	    sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
+		    p, p + size - 1, mem_heap_lo(), mem_heap_hi());
+	    malloc_error(tracenum, i, msg);
+	    goto out;
+	}
+	if (sampled)
+	    memset(p, op.index & 0xFF, size);
+
+	trace.blocks[op.index] = p;
+	trace.block_sizes[op.index] = size;
+	total_size += (double)size - oldsize;
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
+    }
+    if (i != trace.num_ops) {
+	sprintf(msg, "%s has %d requests, not the %d in its header",
+		filename, i, trace.num_ops);
+	app_error(msg);
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    stats->ops = i;
+    stats->util = max_total_size / mem_heapsize();
+    stats->check_secs = (now_ns() - t0 - mm_ns) / 1e9;
+    stats->secs = (mm_ns - i * timer) / 1e9;
+    if (stats->secs <= 0)
+	stats->secs = mm_ns / 1e9;
+    ok = 1;
+
+ out:
+    close_trace_stream(ts);
+    free(trace.blocks);
+    free(trace.block_sizes);
+    return ok;
 }
 
+/*
+ * trace_peak - Find the request after which the trace's live bytes
+ *   peak, from the trace alone, and the peak itself. Overwrites the
+ *   trace's block_sizes.
+ */
+static int trace_peak(trace_t *trace, int *max_total_size)
+{
+    int i, index, peak_op = -1;
+    int total_size = 0;
+
+    *max_total_size = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    total_size += trace->ops[i].size;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    total_size += trace->ops[i].size - trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	default:
+	    total_size -= trace->block_sizes[index];
+	    break;
+	}
+	if (total_size > *max_total_size) {
+	    *max_total_size = total_size;
+	    peak_op = i;
+	}
+    }
+    return peak_op;
+}
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
@@ -784,8 +1989,6 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
@@ -794,81 +1997,640 @@ static void eval_mm_speed(void *ptr)
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    if (replay_trace(trace, trace->num_ops, &mm_allocator, NULL, NULL) <
+	trace->num_ops)
+	app_error("mm_malloc or mm_realloc error in eval_mm_speed");
+}
 
-        case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-		app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
-            break;
+/*
+ * pace_request - replay_trace hook of eval_mm_timed: times request i,
+ *    then waits until request i+1 comes due, offering the wait to
+ *    mm_idle() first
+ */
+static void pace_request(trace_t *trace, int i, void *arg)
+{
+    pacing_t *pc = (pacing_t *)arg;
+    unsigned long long target, now, start;
+    struct timespec ts;
+
+    time_request(trace, i, &pc->timing);
+    if (++i == trace->num_ops)
+	return;
+
+    target = pc->t0;
+    if (trace->stamps[i] > trace->stamps[0])
+	target += (unsigned long long)
+	    ((trace->stamps[i] - trace->stamps[0]) * pc->scale);
+
+    now = pc->timing.start;
+    if (now < target) {
+	pc->gap += target - now;
+
+	/* Offer the gap to the allocator... */
+	start = now;
+	while (now < target && mm_idle()) {
+	    pc->calls++;
+	    now = now_ns();
+	}
+	pc->idle += now - start;
 
-	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
-		app_error("mm_realloc error in eval_mm_speed");
-            trace->blocks[index] = newp;
-            break;
+	/* ... then sleep through long gaps and spin out the rest */
+	if (now + 2000000 < target) {
+	    ts.tv_sec = (target - now - 1000000) / 1000000000;
+	    ts.tv_nsec = (target - now - 1000000) % 1000000000;
+	    nanosleep(&ts, NULL);
+	}
+	while (now_ns() < target)
+	    ;
+    }
+    else if (now > target) {
+	pc->late++;
+	if (now - target > pc->lag)
+	    pc->lag = now - target;
+    }
+    pc->timing.start = now_ns();
+}
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
-            mm_free(block);
-            break;
+/*
+ * eval_mm_timed - Replay a timed trace against the mm package, starting
+ *    each request when its capture timestamp (times scale) comes due
+ *    rather than back to back. Whatever idle time the pacing leaves
+ *    before a request is first offered to mm_idle(), so allocators that
+ *    defer work get credit for doing it off the critical path. Every
+ *    request is timed individually.
+ */
+static void eval_mm_timed(trace_t *trace, double scale, timed_t *timed)
+{
+    pacing_t pc;
+    int n = trace->num_ops;
 
-	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
-        }
+    if (n == 0)  /* nothing to pace, and no latencies to rank */
+	return;
+    memset(&pc, 0, sizeof(pc));
+    if ((pc.timing.ns = (unsigned long long *)
+	 malloc(n * sizeof(unsigned long long))) == NULL)
+	unix_error("malloc failed in eval_mm_timed");
+    pc.scale = scale;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_timed");
+
+    pc.t0 = pc.timing.start = now_ns();
+    if (replay_trace(trace, n, &mm_allocator, pace_request, &pc) < n)
+	app_error("mm_malloc or mm_realloc error in eval_mm_timed");
+
+    rank_latency(pc.timing.ns, n, &timed->lat);
+    timed->timed = 1;
+    timed->gap_secs = pc.gap / 1e9;
+    timed->idle_secs = pc.idle / 1e9;
+    timed->idle_calls = pc.calls;
+    timed->late_ops = pc.late;
+    timed->max_lag = pc.lag / 1e9;
+    free(pc.timing.ns);
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_mm_latency - Time each of the first n requests of a trace (all of
+ *    them if it has fewer) on a freshly initialized mm package, back to
+ *    back. With a budget, mm's maintenance thread runs alongside at that
+ *    percentage. The replay is repeated LATENCY_RUNS times and the lowest
+ *    of each statistic is kept, as the K-best scheme does for throughput.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void eval_mm_latency(trace_t *trace, int n, int budget, latency_t *lat)
 {
-    int i, newsize;
+    int run;
+    timing_t t;
+    latency_t this_run;
+
+    if (n > trace->num_ops)
+	n = trace->num_ops;
+    lat->p50 = lat->p99 = lat->p999 = lat->max = 0;
+    if (n == 0)
+	return;
+    if ((t.ns = (unsigned long long *)
+	 malloc(n * sizeof(unsigned long long))) == NULL)
+	unix_error("malloc failed in eval_mm_latency");
+
+    lat->p50 = lat->p99 = lat->p999 = lat->max = 1e30;
+    for (run = 0; run < LATENCY_RUNS; run++) {
+	mem_reset_brk();
+	if (mm_init() < 0) 
+	    app_error("mm_init failed in eval_mm_latency");
+	if (budget > 0 && start_maintenance(budget) < 0)
+	    app_error("mm_start_maintenance failed in eval_mm_latency");
+
+	t.start = now_ns();
+	if (replay_trace(trace, n, &mm_allocator, time_request, &t) < n)
+	    app_error("mm_malloc or mm_realloc error in eval_mm_latency");
+	mm_stop_maintenance();
+
+	rank_latency(t.ns, n, &this_run);
+	best_latency(lat, &this_run);
+    }
+    free(t.ns);
+}
+
+/*
+ * eval_mm_faults - Time every request of a trace, back to back, on a heap
+ *    whose pages have all been given back to the system, so that growing
+ *    it faults pages in again. With a runway, memlib's runway thread
+ *    faults them in ahead of the heap. Counts the page faults taken on
+ *    the replaying thread itself. Keeps the best of LATENCY_RUNS runs,
+ *    and the pages the runway thread faulted in on the last.
+ */
+static void eval_mm_faults(trace_t *trace, size_t runway, latency_t *lat,
+			   double *faults, double *prefaulted)
+{
+    int run;
+    timing_t t;
+    latency_t this_run;
+    struct rusage before, after;
+    int n = trace->num_ops;
+#ifdef RUSAGE_THREAD
+    int who = RUSAGE_THREAD;
+#else
+    int who = RUSAGE_SELF;   /* counts the runway thread's faults too */
+#endif
+
+    if ((t.ns = (unsigned long long *)
+	 malloc(n * sizeof(unsigned long long))) == NULL)
+	unix_error("malloc failed in eval_mm_faults");
+    memset(t.ns, 0, n * sizeof(unsigned long long));
+
+    *faults = 1e30;
+    lat->p50 = lat->p99 = lat->p999 = lat->max = (n > 0) ? 1e30 : 0;
+    for (run = 0; run < LATENCY_RUNS; run++) {
+	mem_reset_brk();
+	mem_discard();
+	if (runway > 0 && start_runway(runway) < 0)
+	    app_error("mem_set_runway failed in eval_mm_faults");
+	if (mm_init() < 0) 
+	    app_error("mm_init failed in eval_mm_faults");
+
+	getrusage(who, &before);
+	t.start = now_ns();
+	if (replay_trace(trace, n, &mm_allocator, time_request, &t) < n)
+	    app_error("mm_malloc or mm_realloc error in eval_mm_faults");
+	getrusage(who, &after);
+	if (prefaulted != NULL)
+	    *prefaulted = mem_region_prefaulted(mem_default_region()) /
+		(double)mem_pagesize();
+	mem_set_runway(0);
+
+	if (after.ru_minflt - before.ru_minflt < *faults)
+	    *faults = after.ru_minflt - before.ru_minflt;
+	if (n > 0) {
+	    rank_latency(t.ns, n, &this_run);
+	    best_latency(lat, &this_run);
+	}
+    }
+    free(t.ns);
+}
+
+/*
+ * eval_mm_pressure - Check the mm package with the heap capped at limit
+ *    bytes. Running out of memory is allowed here: a malloc or realloc 
+ *    that returns NULL is counted, and the trace goes on without that
+ *    block. Everything mm does return is still checked as in 
+ *    eval_mm_valid, and a failed realloc must leave the old block intact.
+ *    Before the trace starts, the driver fills a quarter of the heap with
+ *    its own cache, which it gives back when mm calls its pressure handler.
+ */
+static void eval_mm_pressure(trace_t *trace, int tracenum, range_t **ranges,
+			     size_t limit, pressure_t *pressure)
+{
+    int i, j;
+    int index, size, oldsize;
     char *p, *newp, *oldp;
+    int max_cached = limit / 4 / APP_CACHE_BLOCK;
+
+    pressure->valid = 0;
+    mem_reset_brk();
+    mem_set_limit(limit);
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed under heap cap.");
+	goto done;
+    }
+
+    /* Fill the application cache */
+    if ((app_cache = (char **)malloc((max_cached + 1) * sizeof(char *))) 
+	== NULL)
+	unix_error("malloc failed in eval_mm_pressure");
+    app_cache_ranges = ranges;
+    app_cache_calls = 0;
+    app_cache_released = 0;
+    for (app_cache_len = 0; app_cache_len < max_cached; app_cache_len++) {
+	if ((p = mm_malloc(APP_CACHE_BLOCK)) == NULL)
+	    break;
+	if (add_range(ranges, p, APP_CACHE_BLOCK, tracenum, 0) == 0)
+	    goto done;
+	app_cache[app_cache_len] = p;
+    }
+    mm_set_pressure_handler(app_cache_release);
 
     for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
+        case ALLOC: /* mm_malloc */
+	    if ((p = replay_malloc(size)) == NULL) {
+		pressure->fails++;
+		trace->blocks[index] = NULL;
+		trace->block_sizes[index] = 0;
+		break;
 	    }
-	    trace->blocks[trace->ops[i].index] = p;
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		goto done;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
 	    break;
 
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
+        case REALLOC: /* mm_realloc */
+	    oldp = trace->blocks[index];
+	    oldsize = trace->block_sizes[index];
+	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+		pressure->fails++;
+		for (j = 0; j < oldsize; j++) {
+		    if ((unsigned char)oldp[j] != (index & 0xFF)) {
+			malloc_error(tracenum, i, "failed mm_realloc did not "
+				     "preserve the old block");
+			goto done;
+		    }
+		}
+		break;
+	    }
+	    remove_range(ranges, oldp);
+	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+		goto done;
+	    if (size < oldsize) oldsize = size;
+	    for (j = 0; j < oldsize; j++) {
+		if ((unsigned char)newp[j] != (index & 0xFF)) {
+		    malloc_error(tracenum, i, "mm_realloc did not preserve the "
+				 "data from old block");
+		    goto done;
+		}
 	    }
-	    trace->blocks[trace->ops[i].index] = newp;
+	    memset(newp, index & 0xFF, size);
+	    trace->blocks[index] = newp;
+	    trace->block_sizes[index] = size;
 	    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+
+        case FREE: /* mm_free */
+	    p = trace->blocks[index];
+	    if (p != NULL) {
+		remove_range(ranges, p);
+		mm_free(p);
+	    }
 	    break;
 
 	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+	    app_error("Nonexistent request type in eval_mm_pressure");
+        }
+    }
+    pressure->valid = 1;
+
+ done:
+    pressure->handler_calls = app_cache_calls;
+    pressure->released = app_cache_released;
+    pressure->heapsize = mem_heapsize();
+    mm_set_pressure_handler(NULL);
+    mem_set_limit(0);
+    free(app_cache);
+    app_cache = NULL;
+}
+
+/*
+ * app_cache_release - The driver's pressure handler for eval_mm_pressure.
+ *    Frees cached blocks until at least size bytes have been given back.
+ */
+static int app_cache_release(size_t size)
+{
+    size_t freed = 0;
+
+    app_cache_calls++;
+    while (freed < size && app_cache_len > 0) {
+	char *p = app_cache[--app_cache_len];
+	remove_range(app_cache_ranges, p);
+	mm_free(p);
+	freed += APP_CACHE_BLOCK;
+    }
+    app_cache_released += freed;
+    return freed > 0;
+}
+
+/*
+ * load_ab_lib - Open an allocator built by "make lib<name>.so" and set
+ *     up its heap. The shared object carries its own copy of memlib,
+ *     bound with -Bsymbolic, so its heap is separate from mm's and from
+ *     every other library's.
+ */
+static void load_ab_lib(char *path, ab_lib_t *lib)
+{
+    void *h;
+    void (*init)(void);
+    char name[MAXLINE];
+
+    /* dlopen searches the library path for a bare file name */
+    if (strchr(path, '/') == NULL)
+	snprintf(name, MAXLINE, "./%s", path);
+    else
+	snprintf(name, MAXLINE, "%s", path);
+    if ((h = dlopen(name, RTLD_NOW | RTLD_LOCAL)) == NULL)
+	app_error((char *)dlerror());
+
+    if ((init = (void (*)(void))dlsym(h, "mem_init")) == NULL ||
+	(lib->mem_reset_brk = (void (*)(void))dlsym(h, "mem_reset_brk"))
+	== NULL ||
+	(lib->mm_init = (int (*)(void))dlsym(h, "mm_init")) == NULL ||
+	(lib->mem_heap_lo = (void *(*)(void))dlsym(h, "mem_heap_lo")) == NULL ||
+	(lib->mem_heap_hi = (void *(*)(void))dlsym(h, "mem_heap_hi")) == NULL ||
+	(lib->alloc.malloc_fn = (void *(*)(size_t))dlsym(h, "mm_malloc"))
+	== NULL ||
+	(lib->alloc.free_fn = (void (*)(void *))dlsym(h, "mm_free")) == NULL ||
+	(lib->alloc.realloc_fn =
+	 (void *(*)(void *, size_t))dlsym(h, "mm_realloc")) == NULL) {
+	snprintf(msg, MAXLINE, "%s doesn't define mem_init, mem_reset_brk, "
+		 "mem_heap_lo, mem_heap_hi and the mm functions", path);
+	app_error(msg);
+    }
+    init();
+}
+
+/*
+ * ab_replay - Replay a trace on one -D library from an empty heap.
+ *     Returns -1 if a request fails.
+ */
+static int ab_replay(ab_lib_t *lib, trace_t *trace)
+{
+    lib->mem_reset_brk();
+    if (lib->mm_init() < 0)
+	return -1;
+    if (replay_trace(trace, trace->num_ops, &lib->alloc, NULL, NULL) <
+	trace->num_ops)
+	return -1;
+    return 0;
+}
+
+/*
+ * ab_check_hook - replay_trace hook of ab_valid: checks each payload
+ *     handed out the way eval_mm_valid does, against the library's own
+ *     heap, and fills it so the next realloc can be checked too
+ */
+static void ab_check_hook(trace_t *trace, int i, void *arg)
+{
+    ab_check_t *c = (ab_check_t *)arg;
+    int index = trace->ops[i].index;
+    int size = trace->ops[i].size;
+    int j, oldsize;
+    char *p = trace->blocks[index];
+
+    if (!c->ok)  /* report only the first error */
+	return;
+    if (trace->ops[i].type != ALLOC)
+	remove_range(&c->ranges, c->blocks[index]);
+    if (trace->ops[i].type == FREE)
+	return;
+
+    if (add_range_in(&c->ranges, p, size, (char *)c->lib->mem_heap_lo(),
+		     (char *)c->lib->mem_heap_hi(), c->tracenum, i) == 0) {
+	c->ok = 0;
+	return;
+    }
+    if (trace->ops[i].type == REALLOC) {
+	oldsize = trace->block_sizes[index];
+	if (size < oldsize) oldsize = size;
+	for (j = 0; j < oldsize; j++) {
+	    if (p[j] != (index & 0xFF)) {
+		malloc_error(c->tracenum, i, "mm_realloc did not preserve the "
+			     "data from old block");
+		c->ok = 0;
+		return;
+	    }
+	}
+    }
+    memset(p, index & 0xFF, size);
+    c->blocks[index] = p;
+    trace->block_sizes[index] = size;
+}
+
+/*
+ * ab_valid - Check a -D library for correctness on a trace, as
+ *     eval_mm_valid checks mm
+ */
+static int ab_valid(ab_lib_t *lib, trace_t *trace, int tracenum)
+{
+    ab_check_t c;
+    int i;
+
+    c.lib = lib;
+    c.tracenum = tracenum;
+    c.ranges = NULL;
+    c.ok = 1;
+    if ((c.blocks = (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
+	unix_error("calloc failed in ab_valid");
+
+    lib->mem_reset_brk();
+    if (lib->mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	c.ok = 0;
+    }
+    else if ((i = replay_trace(trace, trace->num_ops, &lib->alloc,
+			       ab_check_hook, &c)) < trace->num_ops) {
+	if (c.ok)
+	    malloc_error(tracenum, i, "mm_malloc or mm_realloc failed.");
+	c.ok = 0;
+    }
+
+    clear_ranges(&c.ranges);
+    free(c.blocks);
+    return c.ok;
+}
+
+/*
+ * eval_ab - Time AB_RUNS replays of a trace on every -D library,
+ *     interleaved: each run replays it once on every library, starting
+ *     with a different one each time, so drift in clock speed or
+ *     temperature lands on all of them alike. Each library is checked
+ *     on the trace first, in an untimed replay.
+ */
+static void eval_ab(trace_t *trace, int tracenum, ab_lib_t *libs, int nlibs,
+		    ab_t *ab)
+{
+    int r, j, k;
+    unsigned long long start;
+
+    ab->ops = trace->num_ops;
+    for (k = 0; k < nlibs; k++)
+	if (!ab_valid(&libs[k], trace, tracenum)) {
+	    printf("%s failed a check; no A/B runs for this trace.\n",
+		   libs[k].path);
+	    return;
+	}
+    for (r = 0; r < AB_RUNS; r++)
+	for (j = 0; j < nlibs; j++) {
+	    k = (r + j) % nlibs;
+	    start = now_ns();
+	    ab_replay(&libs[k], trace);
+	    ab->secs[k][r] = (now_ns() - start) / 1e9;
 	}
+    ab->valid = 1;
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i;
+
+    if ((i = replay_trace(trace, trace->num_ops, &libc_allocator,
+			  NULL, NULL)) < trace->num_ops) {
+	malloc_error(tracenum, i, "libc malloc or realloc failed");
+	unix_error("System message");
     }
 
     return 1;
 }
 
+/*
+ * libc_util_hook - replay_trace hook of eval_libc_util: fills the
+ *   payload of each block handed out, tracks libc's footprint, and
+ *   samples its residency after the peak request
+ */
+static void libc_util_hook(trace_t *trace, int i, void *arg)
+{
+    libc_util_t *u = (libc_util_t *)arg;
+    int index = trace->ops[i].index;
+    size_t footprint, resident;
+
+    if (trace->ops[i].type != FREE)
+	memset(trace->blocks[index], index & 0xFF, trace->ops[i].size);
+
+    footprint = libc_footprint();
+    if (footprint > u->max_footprint)
+	u->max_footprint = footprint;
+    if (i == u->peak_op && (resident = libc_resident()) > u->base)
+	u->stats->rss_util = (double)u->max_total_size / (resident - u->base);
+}
+
+/*
+ * eval_libc_util - The same peak-live over footprint ratio for libc.
+ *   libc's footprint is the most mallinfo2 says it holds from the
+ *   system during the replay, less what was in use before it, so free
+ *   memory libc still holds after malloc_trim counts against it. The
+ *   residency ratio uses what of libc's memory is resident instead,
+ *   less the same base, right after the request that reaches the
+ *   peak, with payloads written so that the live bytes are resident.
+ */
+static void eval_libc_util(trace_t *trace, stats_t *stats)
+{
+    int i;
+    libc_util_t u;
+    size_t resident;
+    char *cached[LIBC_CACHED];
+
+    /* give back what libc can, so earlier replays' pages don't count */
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    /*
+     * mallinfo2 counts blocks in the thread cache as in use, yet the
+     * replay would reuse them; hold on to them until it is over
+     */
+    for (i = 0; i < LIBC_CACHED; i++)
+	cached[i] = malloc((i / LIBC_CACHE_DEPTH + 1) * 2 * sizeof(void *));
+    u.peak_op = trace_peak(trace, &u.max_total_size);
+    u.max_footprint = 0;
+    u.stats = stats;
+    u.base = libc_in_use();
+    stats->rss_util = 0;
+    if (replay_trace(trace, trace->num_ops, &libc_allocator,
+		     libc_util_hook, &u) < trace->num_ops)
+	unix_error("malloc or realloc failed in eval_libc_util");
+    resident = libc_resident();
+    stats->rss_end = (resident > u.base) ? resident - u.base : 0;
+    stats->util = (u.max_footprint > u.base) ?
+	(double)u.max_total_size / (u.max_footprint - u.base) : 0;
+    for (i = 0; i < LIBC_CACHED; i++)
+	free(cached[i]);
+}
+
+/*
+ * null_malloc, null_realloc, null_free - An allocator that does next
+ *    to nothing: addresses come from a bump counter and are never
+ *    touched, and nothing is ever freed. Kept out of line, so that a
+ *    replay on it still pays for a call per request.
+ */
+static uintptr_t null_brk;
+
+static void * __attribute__((noinline)) null_malloc(size_t size)
+{
+    null_brk += (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+    return (void *)null_brk;
+}
+
+static void * __attribute__((noinline)) null_realloc(void *ptr, size_t size)
+{
+    return (ptr != NULL) ? ptr : null_malloc(size);
+}
+
+static void __attribute__((noinline)) null_free(void *ptr)
+{
+    __asm__ __volatile__("" : : "r"(ptr));
+}
+
+/*
+ * eval_compiled_speed - The trace linked in by "make compiled", replayed
+ *    by straight-line calls with no trace array or dispatch between
+ *    them. Timed by fcyc() like eval_mm_speed.
+ */
+static void eval_compiled_speed(void *ptr)
+{
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_compiled_speed");
+    if (mm_compiled_replay() < 0)
+	app_error("mm_malloc or mm_realloc failed in eval_compiled_speed");
+}
+
+/*
+ * is_compiled_trace - Is the trace read from filename the one linked in
+ *     by "make compiled"? Tracefiles match by base name and request count.
+ */
+static int is_compiled_trace(char *filename, trace_t *trace)
+{
+    char *base = strrchr(filename, '/');
+
+    base = (base != NULL) ? base + 1 : filename;
+    return strcmp(base, mm_compiled_trace) == 0 &&
+	mm_compiled_ops == trace->num_ops;
+}
+
+/*
+ * eval_null_speed - The replay loop of eval_mm_speed on the null
+ *    allocator, timed by fcyc() to measure what the harness itself
+ *    costs: the dispatch on each request and the loads and stores to
+ *    the trace's block array.
+ */
+static void eval_null_speed(void *ptr)
+{
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    null_brk = ALIGNMENT;
+    if (replay_trace(trace, trace->num_ops, &null_allocator, NULL, NULL) <
+	trace->num_ops)
+	app_error("null_malloc error in eval_null_speed");
+}
+
 /* 
  * eval_libc_speed - This is the function that is used by fcyc() to
  *    measure the running time of the libc malloc package on the set
@@ -876,38 +2638,11 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
-	    trace->blocks[index] = p;
-	    break;
-
-	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-	    if ((newp = realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
-	    
-	    trace->blocks[index] = newp;
-	    break;
-	    
-        case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
-	    break;
-	}
-    }
+    if (replay_trace(trace, trace->num_ops, &libc_allocator, NULL, NULL) <
+	trace->num_ops)
+	unix_error("malloc or realloc failed in eval_libc_speed");
 }
 
 /*************************************
@@ -924,54 +2659,826 @@ static void printresults(int n, stats_t *stats)
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double rss_util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%6s%7s%8s%10s%6s%8s%7s\n", 
+	   "trace", " valid", "util", "rss", "endKB", "ops", "secs", "Kops",
+	   "minflt", "majflt");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%5.0f%%%7.0f%8.0f%10.6f%6.0f%8.0f%7.0f\n", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
+		   stats[i].rss_util*100.0,
+		   stats[i].rss_end/1024,
 		   stats[i].ops,
 		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   stats[i].minflt,
+		   stats[i].majflt);
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    rss_util += stats[i].rss_util;
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%6s%7s%8s%10s%6s\n", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
+		   "-",
+		   "-",
 		   "-");
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%5.0f%%%7s%8.0f%10.6f%6.0f\n", 
 	       "Total       ",
 	       (util/n)*100.0,
+	       (rss_util/n)*100.0,
+	       "",
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%6s%7s%8s%10s%6s\n", 
 	       "Total       ",
 	       "-", 
 	       "-", 
+	       "", 
+	       "-", 
 	       "-", 
 	       "-");
     }
 
 }
 
+/*
+ * libc_footprint - bytes libc malloc holds from the system: its heap
+ *     arenas plus its mmapped blocks (mallinfo2), 0 where unknown
+ */
+static size_t libc_footprint(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2();
+
+    return mi.arena + mi.hblkhd;
+#elif defined(__GLIBC__)
+    struct mallinfo mi = mallinfo();
+
+    return (size_t)(unsigned int)mi.arena + (size_t)(unsigned int)mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * libc_in_use - bytes of libc_footprint() in blocks handed out
+ */
+static size_t libc_in_use(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2();
+
+    return mi.uordblks + mi.hblkhd;
+#elif defined(__GLIBC__)
+    struct mallinfo mi = mallinfo();
+
+    return (size_t)(unsigned int)mi.uordblks + (size_t)(unsigned int)mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * libc_resident - bytes of libc malloc's memory resident: the Rss of
+ *     the [heap] mapping its main arena grows (/proc/self/smaps), plus
+ *     its mmapped blocks, which are all handed out; 0 where unknown
+ */
+static size_t libc_resident(void)
+{
+    FILE *fp;
+    char line[MAXLINE];
+    unsigned long kb = 0;
+    size_t mmapped;
+    int in_heap = 0;
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    mmapped = mallinfo2().hblkhd;
+#elif defined(__GLIBC__)
+    mmapped = (size_t)(unsigned int)mallinfo().hblkhd;
+#else
+    return 0;
+#endif
+    if ((fp = fopen("/proc/self/smaps", "r")) == NULL)
+	return 0;
+    /* A mapping's line starts with its address, its fields with a name */
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	if (!isupper((unsigned char)line[0]))
+	    in_heap = strstr(line, "[heap]") != NULL;
+	else if (in_heap && sscanf(line, "Rss: %lu kB", &kb) == 1)
+	    break;
+    }
+    fclose(fp);
+    return (size_t)kb * 1024 + mmapped;
+}
+
+/*
+ * count_faults - run f(arg) once, untimed, and record the minor and
+ *     major page faults it took
+ */
+static void count_faults(void (*f)(void *), void *arg, stats_t *stats)
+{
+    struct rusage before, after;
+
+    getrusage(RUSAGE_SELF, &before);
+    f(arg);
+    getrusage(RUSAGE_SELF, &after);
+    stats->minflt = after.ru_minflt - before.ru_minflt;
+    stats->majflt = after.ru_majflt - before.ru_majflt;
+}
+
+/*
+ * printutil - prints mm's and libc's utilization side by side, by
+ *     footprint and by residency
+ */
+static void printutil(int n, stats_t *libc_stats, stats_t *mm_stats)
+{
+    int i;
+
+    printf("Utilization of mm and libc:\n");
+    printf("%5s%8s%8s%8s%9s\n", "trace", "mm", "libc", "mm rss", "libc rss");
+    for (i = 0; i < n; i++) {
+	if (!mm_stats[i].valid || !libc_stats[i].valid) {
+	    printf("%2d%11s%8s%8s%9s\n", i, "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%10.0f%%%7.0f%%%7.0f%%%8.0f%%\n", i,
+	       mm_stats[i].util * 100, libc_stats[i].util * 100,
+	       mm_stats[i].rss_util * 100, libc_stats[i].rss_util * 100);
+    }
+    printf("libc's footprint is from mallinfo2 (arena + hblkhd), its rss "
+	   "from its [heap] Rss plus hblkhd.\n");
+}
+
+/*
+ * printcompiled - prints the driver's replay of the compiled trace next
+ *     to the compiled replay (-c)
+ */
+static void printcompiled(int n, stats_t *stats)
+{
+    int i, found = 0;
+
+    printf("Compiled replay of %s:\n", mm_compiled_trace);
+    printf("%5s%7s%11s%12s%9s%10s%9s\n", "trace", " valid", "replay(s)",
+	   "compiled(s)", "Kops", "comp Kops", "speedup");
+    for (i = 0; i < n; i++) {
+	if (stats[i].compiled_secs == 0)
+	    continue;
+	found = 1;
+	printf("%2d%10s%11.6f%12.6f%9.0f%10.0f%8.2fx\n", i, "yes",
+	       stats[i].secs, stats[i].compiled_secs,
+	       (stats[i].ops / 1e3) / stats[i].secs,
+	       (stats[i].ops / 1e3) / stats[i].compiled_secs,
+	       stats[i].secs / stats[i].compiled_secs);
+    }
+    if (!found)
+	printf("None of the traces was %s; pick it with -f.\n",
+	       mm_compiled_trace);
+    if (replay_calloc)
+	printf("The compiled replay calls mm_malloc even under -C.\n");
+}
+
+/*
+ * printharness - prints each allocator's raw throughput next to its
+ *     throughput with the null allocator's time, the harness's own
+ *     cost, taken out (-N)
+ */
+static void printharness(int n, stats_t *libc_stats, stats_t *mm_stats)
+{
+    int i;
+    double net;
+
+    printf("Throughput with the harness's cost taken out:\n");
+    printf("%5s%7s%11s%11s%9s%9s", "trace", " valid", "harness(s)",
+	   "mm(s)", "raw Kops", "net Kops");
+    if (libc_stats != NULL)
+	printf("%9s%9s", "libc raw", "libc net");
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	if (!mm_stats[i].valid) {
+	    printf("%2d%10s\n", i, "no");
+	    continue;
+	}
+	net = mm_stats[i].secs - mm_stats[i].harness_secs;
+	printf("%2d%10s%11.6f%11.6f%9.0f", i, "yes",
+	       mm_stats[i].harness_secs, mm_stats[i].secs,
+	       (mm_stats[i].ops / 1e3) / mm_stats[i].secs);
+	if (net > 0)
+	    printf("%9.0f", (mm_stats[i].ops / 1e3) / net);
+	else
+	    printf("%9s", "-");
+	if (libc_stats != NULL && libc_stats[i].valid) {
+	    net = libc_stats[i].secs - libc_stats[i].harness_secs;
+	    printf("%9.0f", (libc_stats[i].ops / 1e3) / libc_stats[i].secs);
+	    if (net > 0)
+		printf("%9.0f", (libc_stats[i].ops / 1e3) / net);
+	    else
+		printf("%9s", "-");
+	}
+	printf("\n");
+    }
+    printf("The harness is the same replay on an allocator that does "
+	   "nothing; - means within its noise.\n");
+}
+
+/*
+ * printtimed - prints the latency summary of the paced (-T) replays
+ */
+static void printtimed(int n, timed_t *timed, double scale)
+{
+    int i, idled = 0;
+
+    /* Leave out the idle columns if mm_idle() never had work to do */
+    for (i = 0; i < n; i++)
+	if (timed[i].timed && timed[i].idle_calls > 0)
+	    idled = 1;
+
+    printf("Timed replay of mm malloc (gaps x%g), latencies in usecs:\n",
+	   scale);
+    printf("%5s%8s%8s%8s%9s%10s", "trace", "p50", "p99", "p99.9", "max",
+	   "gap(ms)");
+    if (idled)
+	printf("%10s%8s", "idle(ms)", "idles");
+    printf("%8s%9s\n", "late", "lag(ms)");
+    for (i = 0; i < n; i++) {
+	if (timed[i].timed) {
+	    printf("%2d%11.2f%8.2f%8.2f%9.2f%10.2f",
+		   i,
+		   timed[i].lat.p50,
+		   timed[i].lat.p99,
+		   timed[i].lat.p999,
+		   timed[i].lat.max,
+		   timed[i].gap_secs * 1e3);
+	    if (idled)
+		printf("%10.2f%8d", timed[i].idle_secs * 1e3,
+		       timed[i].idle_calls);
+	    printf("%8d%9.2f\n", timed[i].late_ops, timed[i].max_lag * 1e3);
+	}
+	else {
+	    printf("%2d%11s%8s%8s%9s%10s", i, "-", "-", "-", "-", "-");
+	    if (idled)
+		printf("%10s%8s", "-", "-");
+	    printf("%8s%9s\n", "-", "-");
+	}
+    }
+    if (!idled)
+	printf("mm_idle() had no work: no trace kept quick lists to trim.\n");
+}
+
+/*
+ * printpressure - prints the results of the heap-capped (-M) replays
+ */
+static void printpressure(int n, pressure_t *pressure, size_t limit)
+{
+    int i;
+
+    printf("Replay with the heap capped at %lu KB:\n", 
+	   (unsigned long)(limit / 1024));
+    printf("%5s%7s%8s%8s%14s%10s\n", "trace", " valid", "fails", "calls",
+	   "released(KB)", "heap(KB)");
+    for (i = 0; i < n; i++) {
+	if (pressure[i].valid)
+	    printf("%2d%10s%8d%8d%14.0f%10.0f\n",
+		   i,
+		   "yes",
+		   pressure[i].fails,
+		   pressure[i].handler_calls,
+		   pressure[i].released / 1024,
+		   pressure[i].heapsize / 1024);
+	else
+	    printf("%2d%10s%8s%8s%14s%10s\n", i,
+		   "no", "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printquick - prints utilization with and without quick classes (-q)
+ */
+static void printquick(int n, quick_t *quick)
+{
+    int i;
+    double gain = 0;
+    int num_valid = 0;
+
+    printf("Utilization with mm's adaptive quick classes:\n");
+    printf("%5s%7s%9s%9s%8s%10s%7s%8s\n", "trace", " valid", "util off",
+	   "util on", "gain", "hits", "added", "retired");
+    for (i = 0; i < n; i++) {
+	if (quick[i].valid) {
+	    printf("%2d%10s%8.1f%%%8.1f%%%7.1f%%%10.0f%7d%8d\n",
+		   i,
+		   "yes",
+		   quick[i].util_off * 100.0,
+		   quick[i].util_on * 100.0,
+		   (quick[i].util_on - quick[i].util_off) * 100.0,
+		   quick[i].hits,
+		   quick[i].added,
+		   quick[i].retired);
+	    gain += quick[i].util_on - quick[i].util_off;
+	    num_valid++;
+	}
+	else
+	    printf("%2d%10s%9s%9s%8s%10s%7s%8s\n", i,
+		   "no", "-", "-", "-", "-", "-", "-");
+    }
+    if (num_valid > 0)
+	printf("Average gain %.1f%%\n", gain / num_valid * 100.0);
+}
+
+/*
+ * printwarm - prints warmup latency and utilization from a cold start
+ *     and from one warmed by a profile of the trace's own first run (-w)
+ */
+static void printwarm(int n, warm_t *warm)
+{
+    int i;
+
+    printf("Warmup (first %d requests) with mm warmed from a profile:\n",
+	   WARMUP_OPS);
+    printf("%5s%7s%8s%10s%10s%10s%10s%9s%9s\n", "trace", " valid",
+	   "classes", "cold p99", "warm p99", "cold max", "warm max",
+	   "util", "warm");
+    for (i = 0; i < n; i++) {
+	if (warm[i].valid) {
+	    printf("%2d%10s%8d%10.3f%10.3f%10.3f%10.3f%8.1f%%%8.1f%%\n",
+		   i,
+		   "yes",
+		   warm[i].classes,
+		   warm[i].cold.p99,
+		   warm[i].warm.p99,
+		   warm[i].cold.max,
+		   warm[i].warm.max,
+		   warm[i].util_cold * 100.0,
+		   warm[i].util_warm * 100.0);
+	}
+	else
+	    printf("%2d%10s%8s%10s%10s%10s%10s%9s%9s\n", i,
+		   "no", "-", "-", "-", "-", "-", "-", "-");
+    }
+    printf("Latencies are in usecs, the best of %d runs.\n", LATENCY_RUNS);
+}
+
+/*
+ * printmaint - prints per-request latency with mm's maintenance done
+ *     inline and on a background thread at the given budget (-B)
+ */
+static void printmaint(int n, maint_t *maint, int budget)
+{
+    int i;
+
+    printf("Latency with mm's maintenance inline and on a thread at %d%%:\n",
+	   budget);
+    printf("%5s%7s%9s%9s%9s%9s%9s%9s%8s%9s%8s\n", "trace", " valid",
+	   "p99", "thread", "p99.9", "thread", "max", "thread", "steps",
+	   "busy(ms)", "pooled");
+    for (i = 0; i < n; i++) {
+	if (maint[i].valid) {
+	    printf("%2d%10s%9.3f%9.3f%9.3f%9.3f%9.1f%9.1f%8.0f%9.2f%8.0f\n",
+		   i,
+		   "yes",
+		   maint[i].inline_lat.p99,
+		   maint[i].bg_lat.p99,
+		   maint[i].inline_lat.p999,
+		   maint[i].bg_lat.p999,
+		   maint[i].inline_lat.max,
+		   maint[i].bg_lat.max,
+		   maint[i].steps,
+		   maint[i].usecs / 1e3,
+		   maint[i].pooled);
+	}
+	else
+	    printf("%2d%10s%9s%9s%9s%9s%9s%9s%8s%9s%8s\n", i,
+		   "no", "-", "-", "-", "-", "-", "-", "-", "-", "-");
+    }
+    printf("Latencies are in usecs, the best of %d runs; the thread's "
+	   "steps and time are from the last.\n", LATENCY_RUNS);
+}
+
+/*
+ * printfaults - prints the page faults taken on the replaying thread,
+ *     and latency, with and without a runway of faulted-in pages (-P)
+ */
+static void printfaults(int n, fault_t *faults, size_t runway)
+{
+    int i;
+    double moved = 0;
+    int num_valid = 0;
+
+    printf("Page faults with a %lu KB runway of faulted-in pages:\n",
+	   (unsigned long)(runway / 1024));
+    printf("%5s%7s%9s%9s%10s%9s%9s%9s%9s\n", "trace", " valid",
+	   "faults", "runway", "prefault", "p99", "runway", "max", "runway");
+    for (i = 0; i < n; i++) {
+	if (faults[i].valid) {
+	    printf("%2d%10s%9.0f%9.0f%10.0f%9.3f%9.3f%9.1f%9.1f\n",
+		   i,
+		   "yes",
+		   faults[i].faults_off,
+		   faults[i].faults_on,
+		   faults[i].prefaulted,
+		   faults[i].off.p99,
+		   faults[i].on.p99,
+		   faults[i].off.max,
+		   faults[i].on.max);
+	    moved += faults[i].faults_off - faults[i].faults_on;
+	    num_valid++;
+	}
+	else
+	    printf("%2d%10s%9s%9s%10s%9s%9s%9s%9s\n", i,
+		   "no", "-", "-", "-", "-", "-", "-", "-");
+    }
+    if (num_valid > 0)
+	printf("Faults moved off the replaying thread: %.0f\n", moved);
+    printf("Latencies are in usecs, the best of %d runs.\n", LATENCY_RUNS);
+}
+
+/*
+ * printsbrk - prints how many times each replay grew the heap and what
+ *     the growth cost, under the sbrk cost model (-S) or the real brk
+ */
+static void printsbrk(int n, sbrk_t *sbrk, long cost, int backend)
+{
+    int i;
+    double calls = 0, usecs = 0;
+
+    if (backend == MEM_BRK)
+	printf("Heap growth on the real brk:\n");
+    else if (cost == MEM_SBRK_SYSCALL)
+	printf("Heap growth charged a no-op system call per mem_sbrk:\n");
+    else
+	printf("Heap growth charged %ld ns per mem_sbrk:\n", cost);
+    printf("%5s%7s%9s%11s%9s%9s\n", "trace", " valid", "calls",
+	   "cost(us)", "us/call", "% time");
+    for (i = 0; i < n; i++) {
+	if (sbrk[i].valid) {
+	    printf("%2d%10s%9.0f%11.1f%9.2f%8.1f%%\n",
+		   i,
+		   "yes",
+		   sbrk[i].calls,
+		   sbrk[i].usecs,
+		   sbrk[i].calls > 0 ? sbrk[i].usecs / sbrk[i].calls : 0,
+		   sbrk[i].secs > 0 ? sbrk[i].usecs / (sbrk[i].secs * 1e4) : 0);
+	    calls += sbrk[i].calls;
+	    usecs += sbrk[i].usecs;
+	}
+	else
+	    printf("%2d%10s%9s%11s%9s%9s\n", i, "no", "-", "-", "-", "-");
+    }
+    printf("Total %15.0f%11.1f\n", calls, usecs);
+    printf("Calls and cost are from one replay; %% time is their share "
+	   "of a timed replay.\n");
+}
+
+/*
+ * printsingle - prints the results of the single pass (-s), with the
+ *     time it spent outside mm
+ */
+static void printsingle(int n, stats_t *stats, double timer)
+{
+    int i;
+    double secs = 0, ops = 0, util = 0;
+
+    printf("%5s%7s %5s%11s%10s%8s%10s\n", "trace", " valid", "util",
+	   "ops", "secs", "Kops", "check(s)");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%10s%6s%11s%10s%8s%10s\n", i, "no", "-", "-", "-",
+		   "-", "-");
+	    continue;
+	}
+	printf("%2d%10s%5.0f%%%11.0f%10.6f%8.0f%10.6f\n", i, "yes",
+	       stats[i].util * 100.0, stats[i].ops, stats[i].secs,
+	       (stats[i].ops / 1e3) / stats[i].secs, stats[i].check_secs);
+	secs += stats[i].secs;
+	ops += stats[i].ops;
+	util += stats[i].util;
+    }
+    if (errors == 0)
+	printf("%12s%5.0f%%%11.0f%10.6f%8.0f\n", "Total       ",
+	       (util / n) * 100.0, ops, secs, (ops / 1e3) / secs);
+    printf("One pass, every request timed on its own; %.1f ns of timer "
+	   "per request taken out.\n", timer);
+    printf("check(s) is the time spent reading the trace and checking "
+	   "blocks; one block id in %d is filled and checked.\n",
+	   SINGLE_SAMPLE);
+}
+
+/*
+ * timer_cost - The time a now_ns() pair adds to what it measures, in ns:
+ *     the average time between back-to-back reads
+ */
+static double timer_cost(void)
+{
+    unsigned long long t0, t = 0;
+    int k;
+
+    t0 = now_ns();
+    for (k = 0; k < TIMER_CALIBRATE; k++)
+	t = now_ns();
+    return (double)(t - t0) / TIMER_CALIBRATE;
+}
+
+/*
+ * printcolors - prints each trace's throughput with the heap starting
+ *     at every offset of the sweep (-O) from a fixed base, and the
+ *     spread between the fastest and the slowest
+ */
+static void printcolors(int n, color_t *colors, stats_t *stats,
+			uintptr_t base, size_t step)
+{
+    int i, k;
+    double lo, hi;
+
+    printf("Throughput (Kops) with the heap at %#lx plus:\n",
+	   (unsigned long)base);
+    printf("%5s%7s", "trace", " valid");
+    for (k = 0; k < COLOR_STEPS; k++)
+	printf("%8lu", (unsigned long)(k * step));
+    printf("%8s\n", "spread");
+    for (i = 0; i < n; i++) {
+	if (!colors[i].valid) {
+	    printf("%2d%10s\n", i, "no");
+	    continue;
+	}
+	printf("%2d%10s", i, "yes");
+	lo = DBL_MAX;
+	hi = 0;
+	for (k = 0; k < COLOR_STEPS; k++) {
+	    if (colors[i].secs[k] == 0) {
+		printf("%8s", "-");
+		continue;
+	    }
+	    printf("%8.0f", (stats[i].ops / 1e3) / colors[i].secs[k]);
+	    if (colors[i].secs[k] < lo)
+		lo = colors[i].secs[k];
+	    if (colors[i].secs[k] > hi)
+		hi = colors[i].secs[k];
+	}
+	if (hi > 0)
+	    printf("%7.1f%%\n", (hi - lo) / lo * 100);
+	else
+	    printf("%8s\n", "-");
+    }
+    printf("Offsets are in bytes; - means the heap couldn't be mapped "
+	   "there.\n");
+}
+
+/*
+ * printab - prints, for every -D library after the first, the mean
+ *     paired difference from the first library's run time with a 95%
+ *     confidence interval
+ */
+static void printab(int n, ab_t *ab, ab_lib_t *libs, int nlibs)
+{
+    int i, k, r;
+    double d, mean, sd, half, a, b;
+
+    for (k = 1; k < nlibs; k++) {
+	printf("%s against %s, %d interleaved runs:\n", libs[k].path,
+	       libs[0].path, AB_RUNS);
+	printf("%5s%7s%9s%9s%9s%9s  %s\n", "trace", " valid", "A Kops",
+	       "B Kops", "diff", "95% CI", "verdict");
+	for (i = 0; i < n; i++) {
+	    if (!ab[i].valid) {
+		printf("%2d%10s\n", i, "no");
+		continue;
+	    }
+	    /* d is B's time over A's in one run, as a percentage */
+	    a = b = mean = sd = 0;
+	    for (r = 0; r < AB_RUNS; r++) {
+		a += ab[i].secs[0][r];
+		b += ab[i].secs[k][r];
+		mean += (ab[i].secs[k][r] / ab[i].secs[0][r] - 1) * 100;
+	    }
+	    mean /= AB_RUNS;
+	    for (r = 0; r < AB_RUNS; r++) {
+		d = (ab[i].secs[k][r] / ab[i].secs[0][r] - 1) * 100 - mean;
+		sd += d * d;
+	    }
+	    sd = sqrt(sd / (AB_RUNS - 1));
+	    half = AB_T95 * sd / sqrt(AB_RUNS);
+	    printf("%2d%10s%9.0f%9.0f%+8.1f%%%7.1f%%  %s\n", i, "yes",
+		   ab[i].ops / 1e3 / (a / AB_RUNS),
+		   ab[i].ops / 1e3 / (b / AB_RUNS), mean, half,
+		   mean - half > 0 ? "B slower" :
+		   mean + half < 0 ? "B faster" : "no difference");
+	}
+    }
+    printf("diff is B's time over A's, paired run by run; the CI is "
+	   "+/- around it.\n");
+}
+
+/*
+ * pin_cpu - Keep the driver on one CPU, so timings don't move with
+ *     scheduler migrations. The helper threads it starts later run on
+ *     the other CPUs it was allowed, if there are any.
+ */
+static void pin_cpu(int cpu)
+{
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(helper_cpus), &helper_cpus) < 0)
+	unix_error("sched_getaffinity failed in pin_cpu");
+    if (CPU_COUNT(&helper_cpus) > 1)
+	CPU_CLR(cpu, &helper_cpus);
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+	unix_error("sched_setaffinity failed in pin_cpu");
+    pinned_cpu = cpu;
+    printf("Pinned to CPU %d.\n", cpu);
+}
+
+/*
+ * helper_affinity - With -p, move the driver onto the helper threads'
+ *     CPUs (on), so that a thread it starts inherits those rather than
+ *     its own, and back onto its own CPU (!on)
+ */
+static void helper_affinity(int on)
+{
+    cpu_set_t set;
+
+    if (pinned_cpu < 0)
+	return;
+    if (on)
+	set = helper_cpus;
+    else {
+	CPU_ZERO(&set);
+	CPU_SET(pinned_cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+	unix_error("sched_setaffinity failed in helper_affinity");
+}
+
+/*
+ * start_maintenance, start_runway - mm_start_maintenance and
+ *     mem_set_runway, with the thread they start kept off the CPU the
+ *     driver is pinned to
+ */
+static int start_maintenance(int budget)
+{
+    int rc;
+
+    helper_affinity(1);
+    rc = mm_start_maintenance(budget);
+    helper_affinity(0);
+    return rc;
+}
+
+static int start_runway(size_t bytes)
+{
+    int rc;
+
+    helper_affinity(1);
+    rc = mem_set_runway(bytes);
+    helper_affinity(0);
+    return rc;
+}
+
+/*
+ * read_sysfs - Read the first line of a sysfs file into buf, without
+ *     the newline. Returns -1 if the file can't be read.
+ */
+static int read_sysfs(char *path, char *buf, int len)
+{
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return -1;
+    if (fgets(buf, len, fp) == NULL) {
+	fclose(fp);
+	return -1;
+    }
+    fclose(fp);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/*
+ * check_env - Report what could make timings noisy on the CPU the
+ *     driver runs on (frequency governor, turbo, SMT siblings, load)
+ *     and measure the noise: the 90th percentile of ENV_PROBES timings
+ *     of a fixed spin over the fastest one. Returns -1 if that is over
+ *     precision percent.
+ */
+static int check_env(double precision)
+{
+    char path[MAXLINE], buf[MAXLINE];
+    unsigned long long t[ENV_PROBES], start;
+    double load[1], noise;
+    volatile unsigned long spin;
+    int cpu = sched_getcpu();
+    int k;
+
+    printf("Environment of CPU %d:\n", cpu);
+    sprintf(path, "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+	    cpu);
+    if (read_sysfs(path, buf, MAXLINE) < 0)
+	printf("  governor: unknown\n");
+    else {
+	printf("  governor: %s\n", buf);
+	if (strcmp(buf, "performance"))
+	    printf("  warning: the clock may change speed during the "
+		   "runs; use the performance governor\n");
+    }
+
+    /* intel_pstate says no_turbo, acpi-cpufreq says boost */
+    if (read_sysfs("/sys/devices/system/cpu/intel_pstate/no_turbo",
+		   buf, MAXLINE) == 0)
+	strcpy(buf, buf[0] == '1' ? "off" : "on");
+    else if (read_sysfs("/sys/devices/system/cpu/cpufreq/boost",
+			buf, MAXLINE) == 0)
+	strcpy(buf, buf[0] == '1' ? "on" : "off");
+    else
+	strcpy(buf, "unknown");
+    printf("  turbo: %s\n", buf);
+    if (!strcmp(buf, "on"))
+	printf("  warning: turbo clocks depend on temperature and on "
+	       "the other cores\n");
+
+    sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/"
+	    "thread_siblings_list", cpu);
+    if (read_sysfs(path, buf, MAXLINE) == 0) {
+	printf("  SMT siblings: %s\n", buf);
+	if (strchr(buf, ',') != NULL || strchr(buf, '-') != NULL)
+	    printf("  warning: another hardware thread shares this core\n");
+    }
+
+    if (getloadavg(load, 1) == 1) {
+	printf("  load average: %.2f on %ld CPUs\n", load[0],
+	       sysconf(_SC_NPROCESSORS_ONLN));
+	if (load[0] >= sysconf(_SC_NPROCESSORS_ONLN))
+	    printf("  warning: every CPU is busy\n");
+    }
+
+    for (spin = 0; spin < ENV_SPIN; spin++) /* warm up */
+	;
+    for (k = 0; k < ENV_PROBES; k++) {
+	start = now_ns();
+	for (spin = 0; spin < ENV_SPIN; spin++)
+	    ;
+	t[k] = now_ns() - start;
+    }
+    qsort(t, ENV_PROBES, sizeof(t[0]), cmp_ull);
+    noise = (double)(t[ENV_PROBES * 9 / 10] - t[0]) / t[0] * 100;
+    printf("  noise: %.1f%% (90th percentile of %d spins over the "
+	   "fastest)\n", noise, ENV_PROBES);
+    if (noise > precision) {
+	printf("Too noisy for %g%% precision; not measuring.\n", precision);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * cmp_ull - qsort comparison for unsigned long longs
+ */
+static int cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * now_ns - read a monotonic clock in nanoseconds
+ */
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * replay_malloc - mm_malloc, or mm_calloc with -C
+ */
+static void *replay_malloc(size_t size)
+{
+    return replay_calloc ? mm_calloc(1, size) : mm_malloc(size);
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +3511,56 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValqwCFNcs] [-f <file>] [-t <dir>] "
+	    "[-T <scale>] [-M <kbytes>] [-B <pct>] [-P <kbytes>] "
+	    "[-H sim|brk|mmap] [-S <ns>|sys]\n"
+	    "\t[-A <addr>[:<offset>]] [-O <step>] [-D <lib.so>]... "
+	    "[-p <cpu>] [-E <pct>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <addr>[:<offset>] Map mm's heap at <addr>, "
+	    "starting <offset> bytes in.\n");
+    fprintf(stderr, "\t-B <pct>   Also compare latency with mm's maintenance "
+	    "inline and on a thread at <pct>%% CPU.\n");
+    fprintf(stderr, "\t-c         Also time the trace compiled in by "
+	    "\"make compiled\".\n");
+    fprintf(stderr, "\t-C         Allocate with mm_calloc instead of "
+	    "mm_malloc.\n");
+    fprintf(stderr, "\t-D <lib>   Compare the allocators in two or more "
+	    "shared objects (up to %d).\n", AB_MAX_LIBS);
+    fprintf(stderr, "\t-E <pct>   Report the CPU's governor, turbo and "
+	    "load, and refuse to run if\n\t           timings vary more "
+	    "than <pct>%%.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F         Fault in all of mm's heap before the "
+	    "replays.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <heap>  Put mm's heap in simulated storage (sim), "
+	    "the real brk (brk)\n\t           or a private mapping (mmap).\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-M <kb>    Also replay with the heap capped at "
+	    "<kb> KB.\n");
+    fprintf(stderr, "\t-N         Also time the harness alone and report "
+	    "throughput without it.\n");
+    fprintf(stderr, "\t-O <step>  Also time each trace with the heap "
+	    "offset by %d multiples of <step>.\n", COLOR_STEPS);
+    fprintf(stderr, "\t-p <cpu>   Run on CPU <cpu> only.\n");
+    fprintf(stderr, "\t-P <kb>    Also count page faults with a <kb> KB "
+	    "runway of faulted-in pages.\n");
+    fprintf(stderr, "\t-q         Report utilization with and without mm's "
+	    "quick classes.\n");
+    fprintf(stderr, "\t-s         Check, measure and time mm in one pass "
+	    "over each trace, streamed\n\t           from its file, and "
+	    "skip every other mm mode.\n");
+    fprintf(stderr, "\t-S <ns>    Charge every mem_sbrk <ns> ns, or a real "
+	    "no-op system call\n\t           (-S sys), and report the heap "
+	    "growth calls.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <scale> Also replay timed traces with their "
+	    "request gaps scaled by <scale>,\n\t           with quick classes on.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
+    fprintf(stderr, "\t-w         Time the first requests of each trace "
+	    "with mm warmed from a profile.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
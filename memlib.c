@@ -2,6 +2,32 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            Each simulated heap lives in a region: a block of storage with
+ *            its own brk pointer. The mem_* functions work on a default
+ *            region set up by mem_init; the mem_region_* functions let a
+ *            program keep several independent heaps side by side.
+ *
+ *            A region can also keep a runway: a thread that faults in the
+ *            pages just past the brk before the heap grows into them, so
+ *            the first writes to new heap memory don't fault on the
+ *            caller's thread.
+ *
+ *            The default region can instead be the process's real heap
+ *            (mem_set_backend): mem_sbrk then moves the program break
+ *            with sbrk, so growing and resetting the heap pay for real
+ *            system calls and page faults. Where the brk can't be moved,
+ *            a private mapping reserved up front stands in for it.
+ *
+ *            Simulated growth is only a pointer add, so a region can be
+ *            given a cost model (mem_set_sbrk_cost) that charges every
+ *            mem_sbrk call a fixed latency or a real no-op system call,
+ *            and counts the calls and the time they took.
+ *
+ *            For reproducible timings, the default heap can be mapped at
+ *            a fixed address (mem_set_base), starting a chosen number of
+ *            bytes in, so that its cache-set mapping is the same from run
+ *            to run whatever ASLR does.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,14 +36,295 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/syscall.h>
 
 #include "memlib.h"
 #include "config.h"
 
+struct mem_region {
+    int backend;      /* MEM_SIMULATED, MEM_BRK or MEM_MMAP */
+    char *base;       /* address a MEM_MMAP region was pinned at, or NULL */
+    size_t color;     /* bytes from the start of the mapping to the heap */
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *max_addr;   /* largest legal heap address */ 
+    size_t size;      /* bytes of storage behind the region */
+    char *guard;      /* MEM_BRK: the page mapped just past the brk */
+
+    /* sbrk cost model (mem_region_set_sbrk_cost) */
+    long sbrk_cost;   /* ns charged per call, or MEM_SBRK_SYSCALL */
+    unsigned long sbrk_calls; /* calls since the heap was last reset */
+    unsigned long long sbrk_ns; /* time they took */
+
+    /* runway (mem_region_set_runway); brk and faulted are shared with it */
+    size_t runway;    /* bytes to keep faulted in past the brk, 0 if none */
+    char *faulted;    /* pages up to here are faulted in */
+    size_t prefaulted;/* bytes the runway thread has faulted in */
+    int discards;     /* bumped when the pages are given back */
+    int stop;         /* tells the runway thread to exit */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/* Most the runway thread faults in per step, so it notices a new brk */
+#define RUNWAY_STEP (64*1024)
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_region_t mem_default;
+
+static void region_setup(mem_region_t *r, size_t size, int backend);
+static char *page_up(char *p);
+
+/*
+ * brk_guard - with on set, map an inaccessible page at the first page
+ *    boundary past the program break, so that only memlib moves the
+ *    brk. The kernel won't move a brk to within a page of another
+ *    mapping, so libc malloc's own sbrk calls fail, and libc grows its
+ *    main arena with mmap instead, a megabyte or more at a time. With
+ *    on clear, take the guard down so memlib can move the brk itself.
+ */
+static void brk_guard(mem_region_t *r, int on)
+{
+    size_t pagesize = (size_t)getpagesize();
+    char *at;
+    void *p;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if (r->guard != NULL) {
+	munmap(r->guard, pagesize);
+	r->guard = NULL;
+    }
+    if (!on)
+	return;
+#ifdef MAP_FIXED_NOREPLACE
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+    at = page_up((char *)sbrk(0));
+    p = mmap(at, pagesize, PROT_NONE, flags, -1, 0);
+    if (p == MAP_FAILED)
+	return;
+    /* older kernels take the address as a hint only */
+    if (p != (void *)at) {
+	munmap(p, pagesize);
+	return;
+    }
+    r->guard = at;
+}
+
+/*
+ * brk_init - make the process's program break the storage behind r,
+ *    starting at the next page. Returns -1 if the brk can't be moved.
+ */
+static int brk_init(mem_region_t *r)
+{
+    size_t pagesize = (size_t)getpagesize();
+    char *cur, *start;
+
+    if ((cur = (char *)sbrk(0)) == (char *)-1)
+	return -1;
+    start = (char *)(((size_t)cur + pagesize - 1) & ~(pagesize - 1));
+
+    /* probe: seccomp, rlimits or a mapping right above can all block it */
+    if (sbrk(start - cur + pagesize) == (void *)-1)
+	return -1;
+    brk(start);
+    r->start_brk = start;
+
+    /* libc malloc would otherwise grow its heap into ours */
+    r->guard = NULL;
+    brk_guard(r, 1);
+    return 0;
+}
+
+/*
+ * map_init - back r with a private mapping with room for size bytes of
+ *    heap starting color bytes in. The mapping goes at base unless it is
+ *    NULL, and fails rather than replace anything already there.
+ */
+static int map_init(mem_region_t *r, size_t size, char *base, size_t color)
+{
+    void *p;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+#ifdef MAP_FIXED_NOREPLACE
+    if (base != NULL)
+	flags |= MAP_FIXED_NOREPLACE;
+#endif
+    p = mmap(base, size + color, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED)
+	return -1;
+    /* older kernels take the address as a hint only */
+    if (base != NULL && p != base) {
+	munmap(p, size + color);
+	return -1;
+    }
+    r->base = base;
+    r->color = color;
+    r->start_brk = (char *)p + color;
+    return 0;
+}
+
+/*
+ * region_init - back r with size bytes of storage from backend; returns
+ *    -1 on failure
+ */
+static int region_init(mem_region_t *r, size_t size, int backend)
+{
+    r->base = NULL;
+    r->color = 0;
+    switch (backend) {
+    case MEM_BRK:
+	if (brk_init(r) < 0)
+	    return -1;
+	break;
+    case MEM_MMAP:
+	if (map_init(r, size, NULL, 0) < 0)
+	    return -1;
+	break;
+    default:
+	if ((r->start_brk = (char *)malloc(size)) == NULL)
+	    return -1;
+	break;
+    }
+    region_setup(r, size, backend);
+    return 0;
+}
+
+/*
+ * region_setup - start an empty heap in the storage just given to r
+ */
+static void region_setup(mem_region_t *r, size_t size, int backend)
+{
+    r->backend = backend;
+    r->size = size;
+    r->sbrk_cost = 0;
+    r->sbrk_calls = 0;
+    r->sbrk_ns = 0;
+    r->max_addr = r->start_brk + size;  /* max legal heap address */
+    r->brk = r->start_brk;              /* heap is empty initially */
+    r->runway = 0;
+    r->faulted = r->start_brk;
+    r->prefaulted = 0;
+    r->discards = 0;
+}
+
+/*
+ * clock_ns - read a monotonic clock in nanoseconds
+ */
+static unsigned long long clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * charge_sbrk - pay what the cost model asks for one call: spin for the
+ *    given latency, or enter the kernel with a brk that moves nothing
+ */
+static void charge_sbrk(mem_region_t *r)
+{
+    unsigned long long end;
+
+    if (r->sbrk_cost == MEM_SBRK_SYSCALL)
+	syscall(SYS_brk, 0);
+    else if (r->sbrk_cost > 0) {
+	end = clock_ns() + r->sbrk_cost;
+	while (clock_ns() < end)
+	    ;
+    }
+}
+
+/*
+ * region_fini - give back the storage behind r
+ */
+static void region_fini(mem_region_t *r)
+{
+    switch (r->backend) {
+    case MEM_BRK:
+	brk_guard(r, 0);
+	brk(r->start_brk);
+	break;
+    case MEM_MMAP:
+	munmap(r->start_brk - r->color, r->size + r->color);
+	break;
+    default:
+	free(r->start_brk);
+	break;
+    }
+}
+
+/*
+ * page_up - round p up to a page boundary
+ */
+static char *page_up(char *p)
+{
+    size_t pagesize = (size_t)getpagesize();
+
+    return (char *)(((size_t)p + pagesize - 1) & ~(pagesize - 1));
+}
+
+/*
+ * fault_in - fault in the pages from lo to hi (page aligned) for writing
+ *    without changing what they hold, since the heap may grow into them
+ *    at any moment
+ */
+static void fault_in(char *lo, char *hi)
+{
+    size_t pagesize = (size_t)getpagesize();
+
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(lo, hi - lo, MADV_POPULATE_WRITE) == 0)
+	return;
+#endif
+    for (; lo < hi; lo += pagesize)
+	__atomic_fetch_or(lo, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * runway_main - the runway thread: keep the pages from the brk to
+ *    runway bytes past it faulted in, a step at a time, and sleep until
+ *    the heap has grown into the runway by half
+ */
+static void *runway_main(void *arg)
+{
+    mem_region_t *r = (mem_region_t *)arg;
+    char *end = (char *)((size_t)(r->start_brk + r->size) &
+			 ~((size_t)getpagesize() - 1));
+    char *base, *lo, *hi, *target;
+    int discards, filling = 0;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->stop) {
+	base = page_up(__atomic_load_n(&r->brk, __ATOMIC_ACQUIRE));
+	lo = (r->faulted > base) ? r->faulted : base;
+	target = (base + r->runway < end) ? base + r->runway : end;
+	/* once started, fill the whole runway before resting again */
+	if ((!filling && lo >= base + r->runway / 2) || lo >= target) {
+	    filling = 0;
+	    pthread_cond_wait(&r->cond, &r->lock);
+	    continue;
+	}
+	filling = 1;
+	hi = (target - lo > RUNWAY_STEP) ? lo + RUNWAY_STEP : target;
+	discards = r->discards;
+	pthread_mutex_unlock(&r->lock);
+
+	fault_in(lo, hi);
+
+	pthread_mutex_lock(&r->lock);
+	if (r->discards == discards) {
+	    r->prefaulted += hi - lo;
+	    __atomic_store_n(&r->faulted, hi, __ATOMIC_RELEASE);
+	}
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
 
 /* 
  * mem_init - initialize the memory system model
@@ -25,13 +332,65 @@ static char *mem_max_addr;   /* largest legal heap address */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+    if (region_init(&mem_default, MAX_HEAP, MEM_SIMULATED) < 0) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
+}
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+/*
+ * mem_set_backend - move the empty default heap to storage from backend.
+ *    MEM_BRK falls back to MEM_MMAP when the brk can't be moved. Returns
+ *    the backend now in use, or -1 if there is no storage for any.
+ */
+int mem_set_backend(int backend)
+{
+    mem_region_t *r = &mem_default;
+    long cost = r->sbrk_cost;
+
+    if (backend == r->backend && r->base == NULL)
+	return backend;
+    mem_region_set_runway(r, 0);
+    region_fini(r);
+    if (region_init(r, MAX_HEAP, backend) < 0) {
+	if (backend == MEM_BRK && region_init(r, MAX_HEAP, MEM_MMAP) == 0)
+	    backend = MEM_MMAP;
+	else if (region_init(r, MAX_HEAP, MEM_SIMULATED) == 0)
+	    backend = MEM_SIMULATED;
+	else
+	    return -1;
+    }
+    r->sbrk_cost = cost;
+    return backend;
+}
+
+/*
+ * mem_set_base - move the empty default heap to a private mapping at
+ *    base, with the heap starting color bytes (a multiple of ALIGNMENT)
+ *    in. Returns -1, leaving the heap in simulated storage, if something
+ *    is already mapped there or the system won't map it.
+ */
+int mem_set_base(void *base, size_t color)
+{
+    mem_region_t *r = &mem_default;
+    long cost = r->sbrk_cost;
+    int rc = 0;
+
+    if (base == NULL || color % ALIGNMENT != 0)
+	return -1;
+    mem_region_set_runway(r, 0);
+    region_fini(r);
+    if (map_init(r, MAX_HEAP, (char *)base, color) == 0)
+	region_setup(r, MAX_HEAP, MEM_MMAP);
+    else {
+	rc = -1;
+	if (region_init(r, MAX_HEAP, MEM_SIMULATED) < 0) {
+	    fprintf(stderr, "mem_set_base: malloc error\n");
+	    exit(1);
+	}
+    }
+    r->sbrk_cost = cost;
+    return rc;
 }
 
 /* 
@@ -39,41 +398,385 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_region_set_runway(&mem_default, 0);
+    region_fini(&mem_default);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_default_region - the region behind the mem_* functions
  */
-void mem_reset_brk()
+mem_region_t *mem_default_region(void)
+{
+    return &mem_default;
+}
+
+/*
+ * mem_region_create - make a new, empty region that can grow to size
+ *    bytes (0 means MAX_HEAP). Returns NULL if there is no storage for it.
+ */
+mem_region_t *mem_region_create(size_t size)
+{
+    mem_region_t *r;
+
+    if ((r = (mem_region_t *)malloc(sizeof(mem_region_t))) == NULL)
+	return NULL;
+    if (region_init(r, size ? size : MAX_HEAP, MEM_SIMULATED) < 0) {
+	free(r);
+	return NULL;
+    }
+    return r;
+}
+
+/*
+ * mem_region_destroy - free a region from mem_region_create and its storage
+ */
+void mem_region_destroy(mem_region_t *r)
+{
+    if (r == NULL || r == &mem_default)
+	return;
+    mem_region_set_runway(r, 0);
+    region_fini(r);
+    free(r);
+}
+
+/*
+ * mem_region_set_limit - cap the region at bytes (at most its size) to
+ *    model a system under memory pressure; 0 removes the cap. Running
+ *    into a cap is expected, so it isn't reported the way running out of
+ *    the whole region is.
+ */
+void mem_region_set_limit(mem_region_t *r, size_t bytes)
+{
+    if (bytes == 0 || bytes > r->size)
+	bytes = r->size;
+    r->max_addr = r->start_brk + bytes;
+}
+
+/*
+ * mem_region_reset_brk - reset the region's brk pointer to make it empty
+ */
+void mem_region_reset_brk(mem_region_t *r)
 {
-    mem_brk = mem_start_brk;
+    if (r->backend == MEM_BRK) {
+	brk_guard(r, 0);
+	brk(r->start_brk);
+	brk_guard(r, 1);
+    }
+    __atomic_store_n(&r->brk, r->start_brk, __ATOMIC_RELEASE);
+    r->sbrk_calls = 0;
+    r->sbrk_ns = 0;
 }
 
 /* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
+ * mem_region_sbrk - simple model of the sbrk function. Extends the heap 
  *    by incr bytes and returns the start address of the new area. In
  *    this model, the heap cannot be shrunk.
  */
-void *mem_sbrk(int incr) 
+void *mem_region_sbrk(mem_region_t *r, int incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk = r->brk;
+    unsigned long long start = 0;
+
+    if (r->sbrk_cost != 0 && r->backend != MEM_BRK) {
+	start = clock_ns();
+	charge_sbrk(r);
+    }
+    r->sbrk_calls++;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ( (incr < 0) || ((r->brk + incr) > r->max_addr)) {
 	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	if (r->max_addr == r->start_brk + r->size)
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    if (r->backend == MEM_BRK) {
+	/* anyone else moving the brk would split the heap in two */
+	if ((char *)sbrk(0) != r->brk) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. The brk was moved "
+		    "outside memlib...\n");
+	    return (void *)-1;
+	}
+	/* the guard only moves when the brk crosses a page; real brk
+	   calls are timed too, to compare with the model */
+	if (page_up(r->brk + incr) != page_up(r->brk))
+	    brk_guard(r, 0);
+	start = clock_ns();
+	if (sbrk(incr) == (void *)-1) {
+	    fprintf(stderr, "ERROR: mem_sbrk failed. sbrk: %s\n",
+		    strerror(errno));
+	    brk_guard(r, 1);
+	    return (void *)-1;
+	}
+	r->sbrk_ns += clock_ns() - start;
+	start = 0;
+	if (r->guard == NULL)
+	    brk_guard(r, 1);
+    }
+    __atomic_store_n(&r->brk, r->brk + incr, __ATOMIC_RELEASE);
+    if (start != 0)
+	r->sbrk_ns += clock_ns() - start;
+
+    /* wake the runway thread once the heap is halfway into the runway */
+    if (r->runway > 0 &&
+	__atomic_load_n(&r->faulted, __ATOMIC_ACQUIRE) < r->brk + r->runway / 2) {
+	pthread_mutex_lock(&r->lock);
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+    }
     return (void *)old_brk;
 }
 
+/*
+ * mem_region_set_runway - keep bytes (rounded to pages) of the region
+ *    faulted in past its brk from a background thread; 0 stops the
+ *    thread. Returns -1 if the thread can't be started, or if the
+ *    region is the real brk, which has no pages past it to fault in.
+ */
+int mem_region_set_runway(mem_region_t *r, size_t bytes)
+{
+    if (r->runway > 0) {
+	pthread_mutex_lock(&r->lock);
+	r->stop = 1;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->thread, NULL);
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+	r->runway = 0;
+    }
+    if (bytes == 0)
+	return 0;
+    if (r->backend == MEM_BRK)
+	return -1;
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    r->stop = 0;
+    r->runway = (size_t)page_up((char *)bytes);
+    if (pthread_create(&r->thread, NULL, runway_main, r) != 0) {
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+	r->runway = 0;
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * mem_region_prefaulted - bytes the region's runway thread has faulted in
+ */
+size_t mem_region_prefaulted(mem_region_t *r)
+{
+    size_t bytes;
+
+    if (r->runway == 0)
+	return r->prefaulted;
+    pthread_mutex_lock(&r->lock);
+    bytes = r->prefaulted;
+    pthread_mutex_unlock(&r->lock);
+    return bytes;
+}
+
+/*
+ * mem_region_discard - give an empty region's pages back to the system,
+ *    so that a heap built in it next faults them in again
+ */
+void mem_region_discard(mem_region_t *r)
+{
+    char *lo = page_up(r->start_brk);
+    char *hi = (char *)((size_t)(r->start_brk + r->size) &
+			~((size_t)getpagesize() - 1));
+
+    /* past an empty brk heap there is nothing mapped to give back */
+    if (r->backend == MEM_BRK)
+	hi = lo;
+    if (r->runway > 0)
+	pthread_mutex_lock(&r->lock);
+    if (hi > lo)
+	madvise(lo, hi - lo, MADV_DONTNEED);
+    __atomic_store_n(&r->faulted, r->start_brk, __ATOMIC_RELEASE);
+    r->prefaulted = 0;
+    r->discards++;
+    if (r->runway > 0) {
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+    }
+}
+
+/*
+ * mem_region_set_sbrk_cost - charge every mem_region_sbrk call ns
+ *    nanoseconds of spinning, or a real no-op system call with
+ *    MEM_SBRK_SYSCALL; 0 makes growth free again. Real brk heaps already
+ *    pay the kernel and ignore the model.
+ */
+void mem_region_set_sbrk_cost(mem_region_t *r, long ns)
+{
+    r->sbrk_cost = ns;
+}
+
+/*
+ * mem_region_sbrk_stats - growth calls made since the heap was last
+ *    reset, and the nanoseconds they took (when a cost model is set or
+ *    the heap is the real brk); either pointer may be NULL
+ */
+void mem_region_sbrk_stats(mem_region_t *r, unsigned long *calls,
+			   unsigned long long *ns)
+{
+    if (calls != NULL)
+	*calls = r->sbrk_calls;
+    if (ns != NULL)
+	*ns = r->sbrk_ns;
+}
+
+/*
+ * mem_region_populate - fault in all of the region's storage up front,
+ *    so that replays on it don't take first-touch faults. Pages stay in
+ *    until mem_region_discard. Returns -1 for the real brk, which has no
+ *    storage past the heap to fault in.
+ */
+int mem_region_populate(mem_region_t *r)
+{
+    char *lo = page_up(r->start_brk);
+    char *hi = (char *)((size_t)(r->start_brk + r->size) &
+			~((size_t)getpagesize() - 1));
+
+    if (r->backend == MEM_BRK)
+	return -1;
+    if (hi > lo)
+	fault_in(lo, hi);
+    return 0;
+}
+
+/*
+ * mem_region_resident - bytes of the region's heap in pages that are
+ *    resident in memory (mincore), counting every page the heap overlaps
+ */
+size_t mem_region_resident(mem_region_t *r)
+{
+    size_t pagesize = (size_t)getpagesize();
+    char *lo = (char *)((size_t)r->start_brk & ~(pagesize - 1));
+    char *hi = page_up(r->brk);
+    unsigned char vec[256];
+    size_t n, i, pages = 0;
+
+    for (; lo < hi; lo += n * pagesize) {
+	n = (size_t)(hi - lo) / pagesize;
+	if (n > sizeof(vec))
+	    n = sizeof(vec);
+	if (mincore(lo, n * pagesize, vec) < 0)
+	    return 0;
+	for (i = 0; i < n; i++)
+	    pages += vec[i] & 1;
+    }
+    return pages * pagesize;
+}
+
+/*
+ * mem_region_lo - return address of the region's first heap byte
+ */
+void *mem_region_lo(mem_region_t *r)
+{
+    return (void *)r->start_brk;
+}
+
+/*
+ * mem_region_hi - return address of the region's last heap byte
+ */
+void *mem_region_hi(mem_region_t *r)
+{
+    return (void *)(r->brk - 1);
+}
+
+/*
+ * mem_region_heapsize - returns the region's heap size in bytes
+ */
+size_t mem_region_heapsize(mem_region_t *r)
+{
+    return (size_t)(r->brk - r->start_brk);
+}
+
+/*
+ * mem_set_limit - cap the default heap; see mem_region_set_limit
+ */
+void mem_set_limit(size_t bytes)
+{
+    mem_region_set_limit(&mem_default, bytes);
+}
+
+/*
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ */
+void mem_reset_brk()
+{
+    mem_region_reset_brk(&mem_default);
+}
+
+/*
+ * mem_set_runway - keep a runway of faulted-in pages past the default
+ *    heap's brk; see mem_region_set_runway
+ */
+int mem_set_runway(size_t bytes)
+{
+    return mem_region_set_runway(&mem_default, bytes);
+}
+
+/*
+ * mem_discard - give the empty default heap's pages back to the system
+ */
+void mem_discard(void)
+{
+    mem_region_discard(&mem_default);
+}
+
+/*
+ * mem_set_sbrk_cost - set the default heap's sbrk cost model; see
+ *    mem_region_set_sbrk_cost
+ */
+void mem_set_sbrk_cost(long ns)
+{
+    mem_region_set_sbrk_cost(&mem_default, ns);
+}
+
+/*
+ * mem_sbrk_stats - the default heap's growth calls and their cost
+ */
+void mem_sbrk_stats(unsigned long *calls, unsigned long long *ns)
+{
+    mem_region_sbrk_stats(&mem_default, calls, ns);
+}
+
+/*
+ * mem_populate - fault in all of the default heap's storage; see
+ *    mem_region_populate
+ */
+int mem_populate(void)
+{
+    return mem_region_populate(&mem_default);
+}
+
+/*
+ * mem_resident - bytes of the default heap resident in memory
+ */
+size_t mem_resident(void)
+{
+    return mem_region_resident(&mem_default);
+}
+
+/* 
+ * mem_sbrk - extend the default heap by incr bytes
+ */
+void *mem_sbrk(int incr) 
+{
+    return mem_region_sbrk(&mem_default, incr);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_region_lo(&mem_default);
 }
 
 /* 
@@ -81,7 +784,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_region_hi(&mem_default);
 }
 
 /*
@@ -89,7 +792,7 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_region_heapsize(&mem_default);
 }
 
 /*
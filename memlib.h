@@ -1,11 +1,58 @@
 #include <unistd.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
+void mem_set_limit(size_t bytes);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+int mem_set_runway(size_t bytes);
+void mem_discard(void);
+int mem_populate(void);
+size_t mem_resident(void);
+
+/* Storage behind the default heap (mem_set_backend) */
+#define MEM_SIMULATED 0    /* a buffer from libc malloc */
+#define MEM_BRK       1    /* the process's own program break */
+#define MEM_MMAP      2    /* a private mapping reserved up front */
+
+int mem_set_backend(int backend);
+int mem_set_base(void *base, size_t color);
+
+/* Cost charged per mem_sbrk call: ns of spinning, or a real syscall */
+#define MEM_SBRK_SYSCALL (-1L)
+
+void mem_set_sbrk_cost(long ns);
+void mem_sbrk_stats(unsigned long *calls, unsigned long long *ns);
+
+/* Independent simulated heaps; the functions above use the default one */
+typedef struct mem_region mem_region_t;
+
+mem_region_t *mem_default_region(void);
+mem_region_t *mem_region_create(size_t size);
+void mem_region_destroy(mem_region_t *r);
+void *mem_region_sbrk(mem_region_t *r, int incr);
+void mem_region_reset_brk(mem_region_t *r);
+void mem_region_set_limit(mem_region_t *r, size_t bytes);
+void *mem_region_lo(mem_region_t *r);
+void *mem_region_hi(mem_region_t *r);
+size_t mem_region_heapsize(mem_region_t *r);
+int mem_region_set_runway(mem_region_t *r, size_t bytes);
+size_t mem_region_prefaulted(mem_region_t *r);
+void mem_region_discard(mem_region_t *r);
+int mem_region_populate(mem_region_t *r);
+size_t mem_region_resident(mem_region_t *r);
+void mem_region_set_sbrk_cost(mem_region_t *r, long ns);
+void mem_region_sbrk_stats(mem_region_t *r, unsigned long *calls,
+			   unsigned long long *ns);
 
+#ifdef __cplusplus
+}
+#endif
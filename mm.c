@@ -9,14 +9,16 @@
  *
  * BLOCK LAYOUT
  *
- * hdr  ssssssss ssssssss ssssssss ssssssss ssssssss ssssssss ssssssss sssssxxa
+ * hdr  ssssssss ssssssss ssssssss ssssssss ssssssss ssssssss ssssssss sssssxza
  * bp-> pppppppp pppppppp pppppppp pppppppp pppppppp pppppppp pppppppp pppppppp
  *      pppppppp pppppppp pppppppp pppppppp pppppppp pppppppp pppppppp pppppppp
- * ftr  ssssssss ssssssss ssssssss ssssssss ssssssss ssssssss ssssssss sssssxxa
+ * ftr  ssssssss ssssssss ssssssss ssssssss ssssssss ssssssss ssssssss sssssxza
  *
  * Each character is one bit, with each character standing for:
  * s - size of block (including header + footer)
  * x - unused (should always be zero, since size is always divisible by 8)
+ * z - zeroed: a block in the zero pool whose payload has been cleared, all
+ *     but the pool's link word. Rewriting the header clears it.
  * p - payload
  * 
  * The block pointer for this block is designated by the "bp->" in symbol. To
@@ -33,7 +35,14 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -61,16 +70,18 @@ team_t team = {
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 #define WSIZE 4
 #define DSIZE 8
 #define CHUNK_SIZE (1<<12)
 
-#define PACK(size, alloc)   (size | alloc)
+#define PACK(size, alloc)   ((size) | (alloc))
 #define GET(p)              (*(unsigned int *)(p))
 #define PUT(p, val)         (*(unsigned int *)(p) = (val))
 #define GET_SIZE(p)         (GET(p) & ~0x7)
 #define GET_ALLOC(p)        (GET(p) & 0x1)
+#define GET_ZEROED(p)       (GET(p) & 0x2)
 #define HDRP(bp)            ((char *)(bp) - WSIZE)
 #define FTRP(bp)            ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
@@ -82,40 +93,241 @@ team_t team = {
 PUT(HDRP(bp), PACK(size, alloc)); \
 PUT(FTRP(bp), PACK(size, alloc));
 
-static void *extend_heap();
-static inline void *coalesce();
+/*
+ * Quick classes: the heap samples the sizes it is asked for, and every
+ * QUICK_EPOCH mallocs makes the (at most quick_max) sizes that took at
+ * least a QUICK_SHARE of the requests into exact-size classes. A freed
+ * block of a quick size stays marked allocated and goes on its class's
+ * list instead of coalescing, and the next request for that size takes
+ * it back without a search or split. A class that falls out of the top
+ * sizes is retired and its blocks freed for real; reclaim() and mm_idle()
+ * also give blocks back. Heaps have none unless mm_set_quick_classes()
+ * asks for them.
+ */
+#define QUICK_MAX       MM_QUICK_MAX
+#define QUICK_EPOCH     1024        // mallocs between reviews of the classes
+#define QUICK_SHARE     8           // a quick size takes 1/QUICK_SHARE of requests
+#define SAMPLE_BITS     6
+#define SAMPLE_SLOTS    (1<<SAMPLE_BITS)
+#define IDLE_BATCH      64          // blocks mm_idle gives back per call
+#define WARM_MAX        (1<<22)     // most bytes a warm start pre-carves
+
+/*
+ * Maintenance: quick class reviews, freeing the blocks of retired classes
+ * and trimming quick lists. By default the malloc and free that run into
+ * this work do it inline. With mm_start_maintenance(), a background thread
+ * does it for the default heap instead: malloc and free only publish work
+ * items (WORK_* bits, set with an atomic or), and the thread takes them
+ * up every MAINT_PERIOD, in steps of at most IDLE_BATCH blocks, for no more
+ * than its CPU budget per period. The heap is then guarded by maint_lock,
+ * which the mm_* functions take around each call.
+ */
+#define MAINT_PERIOD    1000000     // ns between the thread's rounds
+#define WORK_REVIEW     0x1         // an epoch ended; review quick classes
+#define WORK_TRIM       0x2         // a quick list is longer than its use
+#define WORK_DRAIN      0x4         // retired classes have blocks to free
+#define WORK_ZERO       0x8         // the zero pool has blocks to clear
+
+/*
+ * Zero pool: while the maintenance thread runs, large freed blocks are
+ * parked in a pool, still marked allocated, instead of going back to the
+ * heap. The thread clears them with non-temporal stores, so the zeroes
+ * don't push the application's data out of the cache, and mm_calloc takes
+ * cleared blocks from the pool before paying for a memset itself.
+ */
+#define ZERO_MIN        4096        // smallest block worth clearing ahead
+#define ZERO_POOL_MAX   (1<<20)     // most bytes parked in the pool
+#define ZERO_STEP       (64*1024)   // most bytes cleared per step
+
+struct quick_class {
+    size_t size;                    // block size, header and footer included
+    char *head;                     // list linked through the payloads
+    unsigned int len;               // blocks on the list
+    unsigned int hits;              // mallocs served this epoch
+    unsigned int live;              // blocks of this size handed out now
+    unsigned int peak;              // most ever handed out at once
+};
+
+// Everything one heap needs; mm_heap_t in mm.h
+struct mm_heap {
+    mem_region_t *region;           // where the heap's memory comes from
+    char *heap_listp;               // prologue block
+    char *last_find;                // where the last next-fit search stopped
+    mm_pressure_fn pressure_handler; // run when out of room (may be NULL)
+
+    int quick_max;                  // quick classes allowed; 0 turns them off
+    int nquick;
+    struct quick_class quick[QUICK_MAX];
+    unsigned int epoch_left;        // mallocs until the next review
+    struct {
+        size_t size;
+        unsigned int count;
+    } samples[SAMPLE_SLOTS];        // request sizes seen this epoch
+
+    struct quick_class deferred[QUICK_MAX]; // retired, freed in the background
+    int ndeferred;
+    int maint;                      // a maintenance thread serves the heap
+    unsigned int work;              // WORK_* items published for it
+    char *zero_pool;                // parked large blocks, linked through payloads
+    size_t zero_bytes;              // their total size
+    char *zeroing;                  // the pool block being cleared
+    size_t zero_done;               // payload bytes of it cleared so far
+
+    size_t quick_hits;              // totals for mm_get_stats
+    size_t quick_added;
+    size_t quick_retired;
+    size_t maint_steps;
+    size_t maint_ns;
+    size_t calloc_pooled;
+    size_t calloc_cleared;
+    size_t zeroed_bytes;
+};
+
+// Space taken by a struct mm_heap at the start of its region
+#define HEAP_HDR_SIZE       ALIGN(sizeof(struct mm_heap))
+
+static int heap_init(mm_heap_t *h, mem_region_t *region);
+static void *extend_heap(mm_heap_t *h, size_t words);
+static inline void *coalesce(mm_heap_t *h, void *bp);
 
-static void *find_fit(size_t size);
+static void *find_fit(mm_heap_t *h, size_t size);
 static void *find_fit_from_to(size_t size, void *from, void *to);
 static inline void place(void *bp, size_t size);
 
+static void *malloc_under_pressure(mm_heap_t *h, size_t size);
+static void *extend_heap_shortfall(mm_heap_t *h, size_t size);
+static int reclaim(mm_heap_t *h);
+static void quick_sample(mm_heap_t *h, size_t size);
+static void quick_review(mm_heap_t *h);
+static int quick_release(mm_heap_t *h, struct quick_class *q, unsigned int n);
+static int warm_start(mm_heap_t *h, const mm_stats_t *profile);
+static void maint_halt(mm_heap_t *h);
+static void *maint_main(void *arg);
+static int maint_step(mm_heap_t *h);
+static int zero_step(mm_heap_t *h);
+static int zero_release(mm_heap_t *h);
+static char *zero_take(mm_heap_t *h, size_t size, int zeroed);
+static void zero_fill(char *p, size_t n);
+static void restore_block(mm_heap_t *h, void *bp, size_t size);
+
 #if DEBUG
-#define CHECK_HEAP(s, ...) check_heap(s, ##__VA_ARGS__)
-static void check_heap(const char *title, ...);
+#define CHECK_HEAP(s, ...) check_heap(h, s, ##__VA_ARGS__)
+static void check_heap(mm_heap_t *h, const char *title, ...);
 #else
 #define CHECK_HEAP(s, ...)
 #endif
 
 
-static char * heap_listp;
+// The heap behind mm_malloc and friends, on memlib's default region
+static mm_heap_t default_heap;
+
+// Maximum number of times to ask the application for memory per request
+#define MAX_PRESSURE_ROUNDS 8
+
+// Quick classes for heaps set up from now on (mm_set_quick_classes);
+// off unless asked for, since they cost utilization on most traces
+static int quick_classes = 0;
+
+// Profile heaps set up from now on are warmed from (mm_set_warm_profile)
+static mm_stats_t warm_profile;
+static int warm_profile_set = 0;
+
+// The default heap's maintenance thread (mm_start_maintenance)
+static pthread_mutex_t maint_lock;
+static pthread_t maint_thread;
+static int maint_budget;            // percent of each period it may work
+static int maint_stop;
+
+#define HEAP_LOCK()     do { if ( default_heap.maint ) pthread_mutex_lock(&maint_lock); } while (0)
+#define HEAP_UNLOCK()   do { if ( default_heap.maint ) pthread_mutex_unlock(&maint_lock); } while (0)
 
 /* 
  * mm_init - initialize the malloc package.
  */
 int mm_init(void)
 {
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1)
+    // the old heap is gone, work and all
+    maint_halt(&default_heap);
+    return heap_init(&default_heap, mem_default_region());
+}
+
+/*
+ * mm_heap_create - Make a heap of its own in region, which must be empty
+ *     and is the heap's alone from then on. The mm_heap_t is kept at the
+ *     start of the region, so the heap needs no other memory. Returns NULL
+ *     if the region is in use or too small.
+ */
+mm_heap_t *mm_heap_create(mem_region_t *region)
+{
+    mm_heap_t *h;
+
+    if ( mem_region_heapsize(region) != 0 )
+        return NULL;
+
+    if ((h = mem_region_sbrk(region, HEAP_HDR_SIZE)) == (void *)-1)
+        return NULL;
+
+    h->pressure_handler = NULL;
+    if (heap_init(h, region) < 0)
+    {
+        mem_region_reset_brk(region);
+        return NULL;
+    }
+
+    return h;
+}
+
+/*
+ * mm_heap_destroy - Give back all of a heap's memory at once. Every block
+ *     from the heap, and h itself, is invalid afterwards; the region is
+ *     left empty and can hold a new heap.
+ */
+void mm_heap_destroy(mm_heap_t *h)
+{
+    if ( h != NULL )
+        mem_region_reset_brk(h->region);
+}
+
+/*
+ * heap_init - Lay down the prologue and epilogue at the region's brk and
+ *     grow the heap by its first chunk.
+ */
+static int heap_init(mm_heap_t *h, mem_region_t *region)
+{
+    char *heap_listp;
+
+    if ((heap_listp = mem_region_sbrk(region, 4*WSIZE)) == (void *)-1)
         return -1;
 
     PUT(heap_listp, 0);                             // Alignment Padding
     PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1));    // Prologue Header
     PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1));    // Prologue Footer
     PUT(heap_listp + (3*WSIZE), PACK(0, 1));        // Epilogue header
-    heap_listp += (2*WSIZE);
+    h->region = region;
+    h->heap_listp = heap_listp + (2*WSIZE);
+    h->last_find = NULL;
+
+    h->quick_max = quick_classes;
+    h->nquick = 0;
+    h->epoch_left = QUICK_EPOCH;
+    memset(h->samples, 0, sizeof(h->samples));
+    h->ndeferred = 0;
+    h->maint = 0;
+    h->work = 0;
+    h->quick_hits = h->quick_added = h->quick_retired = 0;
+    h->zero_pool = h->zeroing = NULL;
+    h->zero_bytes = h->zero_done = 0;
+    h->maint_steps = h->maint_ns = 0;
+    h->calloc_pooled = h->calloc_cleared = h->zeroed_bytes = 0;
 
     CHECK_HEAP("PRE-INIT");
 
-    if (extend_heap(CHUNK_SIZE/WSIZE) == NULL)
+    if ( warm_profile_set && h->quick_max > 0 )
+    {
+        if (warm_start(h, &warm_profile) < 0)
+            return -1;
+    }
+    else if (extend_heap(h, CHUNK_SIZE/WSIZE) == NULL)
         return -1;
 
     CHECK_HEAP("INITIAL HEAP");
@@ -123,14 +335,14 @@ int mm_init(void)
     return 0;
 }
 
-static void *extend_heap(size_t words)
+static void *extend_heap(mm_heap_t *h, size_t words)
 {
     char *bp;
     size_t size;
 
     // Allocate even number of words to maintain alignment
     size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-    if ((long)(bp = mem_sbrk(size)) == -1)
+    if ((long)(bp = mem_region_sbrk(h->region, size)) == -1)
         return NULL;
 
     #if DEBUG
@@ -147,7 +359,7 @@ static void *extend_heap(size_t words)
     printf("########################\n\n");
     #endif
 
-    return coalesce(bp);
+    return coalesce(h, bp);
 }
 
 /* 
@@ -155,10 +367,25 @@ static void *extend_heap(size_t words)
  *     Always allocate a block whose size is a multiple of the alignment.
  */
 void *mm_malloc(size_t size)
+{
+    void *bp;
+
+    HEAP_LOCK();
+    bp = mm_heap_malloc(&default_heap, size);
+    HEAP_UNLOCK();
+    return bp;
+}
+
+/*
+ * mm_heap_malloc - mm_malloc from heap h
+ */
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
 {
     size_t adj_size;    // adjusted size for header/footer and alignment
     size_t extend_size; // amount to extend if no fit
+    struct quick_class *q = NULL;
     char *bp;
+    int i;
 
     // ignore pointless calls
     if ( size == 0 ) return NULL;
@@ -168,39 +395,178 @@ void *mm_malloc(size_t size)
     else
         adj_size = DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
 
-    if ((bp = find_fit(adj_size)) != NULL)
+    if ( h->quick_max > 0 )
+    {
+        quick_sample(h, adj_size);
+        for (i = 0; i < h->nquick && q == NULL; i++)
+        {
+            if ( h->quick[i].size == adj_size )
+                q = &h->quick[i];
+        }
+
+        if ( q != NULL && ++q->live > q->peak )
+            q->peak = q->live;
+
+        if ( q != NULL && q->head != NULL )
+        {
+            bp = q->head;
+            q->head = *(char **)bp;
+            q->len--;
+            q->hits++;
+            h->quick_hits++;
+            return bp;
+        }
+    }
+
+    if ((bp = find_fit(h, adj_size)) != NULL)
     {
         place(bp, adj_size);
         CHECK_HEAP("Malloc size: %zu(%zu), bp: %p", size, adj_size, bp);
         return bp;
     }
 
+    // rather than grow, use a block waiting in the zero pool
+    if ( h->zero_pool != NULL && (bp = zero_take(h, adj_size, 0)) != NULL )
+    {
+        CHECK_HEAP("Malloc size: %zu(%zu), bp: %p", size, adj_size, bp);
+        return bp;
+    }
+
     extend_size = MAX(adj_size, CHUNK_SIZE);
-    if ((bp = extend_heap(extend_size/WSIZE)) == NULL)
+    if ((bp = extend_heap(h, extend_size/WSIZE)) == NULL &&
+        (bp = malloc_under_pressure(h, adj_size)) == NULL)
+    {
+        if ( q != NULL )
+            q->live--;
         return NULL;
+    }
 
     place(bp, adj_size);
     CHECK_HEAP("Malloc size: %zu(%zu), bp: %p", size, adj_size, bp);
     return bp;
 }
 
-static char *last_find = NULL;
-static void *find_fit(size_t size)
+/*
+ * mm_set_pressure_handler - Register a function to call when the heap
+ *     can't grow any further. It's passed the block size that couldn't
+ *     be placed, may mm_free whatever the application can spare, and
+ *     should return nonzero if it freed anything. NULL unregisters it.
+ */
+void mm_set_pressure_handler(mm_pressure_fn handler)
+{
+    mm_heap_set_pressure_handler(&default_heap, handler);
+}
+
+void mm_heap_set_pressure_handler(mm_heap_t *h, mm_pressure_fn handler)
+{
+    h->pressure_handler = handler;
+}
+
+/*
+ * malloc_under_pressure - Slow path for when mem_sbrk can't give us a
+ *     full extension. Everything cheap is tried before failing: first
+ *     reclaim what mm itself is holding, then grow by only the shortfall
+ *     past a free block at the end of the heap, and finally ask the
+ *     application to give memory back, retrying after each round.
+ */
+static void *malloc_under_pressure(mm_heap_t *h, size_t size)
+{
+    void *bp;
+    int round;
+
+    if (reclaim(h) && (bp = find_fit(h, size)) != NULL)
+        return bp;
+
+    if ((bp = extend_heap_shortfall(h, size)) != NULL)
+        return bp;
+
+    for (round = 0; h->pressure_handler != NULL && round < MAX_PRESSURE_ROUNDS; round++)
+    {
+        if (!h->pressure_handler(size))
+            break;
+
+        if ((bp = find_fit(h, size)) != NULL || (bp = extend_heap_shortfall(h, size)) != NULL)
+            return bp;
+    }
+
+    return NULL;
+}
+
+/*
+ * extend_heap_shortfall - Grow the heap by just enough to make a block of
+ *     size bytes at its end, counting a free block already sitting there.
+ */
+static void *extend_heap_shortfall(mm_heap_t *h, size_t size)
+{
+    char *epilogue = (char *)mem_region_hi(h->region) + 1;    // bp of the epilogue
+    char *last = PREV_BLKP(epilogue);
+    size_t have = GET_ALLOC(HDRP(last)) ? 0 : GET_SIZE(HDRP(last));
+
+    if (have >= size)
+        return last;
+
+    return extend_heap(h, (size - have)/WSIZE);
+}
+
+/*
+ * reclaim - Give back everything mm holds on to so that it can be reused:
+ *     walks the heap and merges any neighbouring free blocks. Frees
+ *     coalesce immediately, so this normally finds nothing; it is the
+ *     place where any deferred frees get flushed. Returns nonzero if any
+ *     blocks were merged.
+ */
+static int reclaim(mm_heap_t *h)
+{
+    char *bp = NEXT_BLKP(h->heap_listp);
+    size_t size;
+    int merged = 0;
+    int i;
+
+    for (i = 0; i < h->nquick; i++)
+        merged |= quick_release(h, &h->quick[i], h->quick[i].len);
+    for (; h->ndeferred > 0; h->ndeferred--)
+        merged |= quick_release(h, &h->deferred[h->ndeferred-1], h->deferred[h->ndeferred-1].len);
+    merged |= zero_release(h);
+
+    while (GET_SIZE(HDRP(bp)) != 0)
+    {
+        if (!GET_ALLOC(HDRP(bp)) && !GET_ALLOC(HDRP(NEXT_BLKP(bp))) &&
+            GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+        {
+            // last_find may point at the block being merged away
+            if ( h->last_find == NEXT_BLKP(bp) )
+                h->last_find = bp;
+
+            size = GET_SIZE(HDRP(bp)) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
+            PUT_HDR_FTR(bp, size, 0);
+            merged = 1;
+            continue;
+        }
+        bp = NEXT_BLKP(bp);
+    }
+
+    return merged;
+}
+
+static void *find_fit(mm_heap_t *h, size_t size)
 {
+    char *last_find = h->last_find;
+    void *heap_hi = mem_region_hi(h->region);
+
     if ( last_find == NULL )
     {
         // find fit hasn't run yet. run from beginning to end of heap
-        last_find = find_fit_from_to(size, NEXT_BLKP(heap_listp), mem_heap_hi());
-        return last_find;
+        h->last_find = find_fit_from_to(size, NEXT_BLKP(h->heap_listp), heap_hi);
+        return h->last_find;
     }
     
     // find fit from last find to end
     
-    if ( (last_find = find_fit_from_to(size, NEXT_BLKP(last_find), mem_heap_hi())) == NULL )
+    if ( (h->last_find = find_fit_from_to(size, NEXT_BLKP(last_find), heap_hi)) == NULL )
         // didn't find anything from last find to end. run from beginning to last find
-        last_find = find_fit_from_to(size, NEXT_BLKP(heap_listp), last_find);
+        h->last_find = find_fit_from_to(size, NEXT_BLKP(h->heap_listp), h->last_find);
 
-    return last_find;
+    return h->last_find;
 }
 
 static void *find_fit_from_to(size_t size, void *from, void *to)
@@ -237,22 +603,156 @@ inline static void place(void *bp, size_t size)
  * mm_free - Freeing a block does nothing.
  */
 void mm_free(void *bp)
+{
+    HEAP_LOCK();
+    mm_heap_free(&default_heap, bp);
+    HEAP_UNLOCK();
+}
+
+/*
+ * mm_heap_free - mm_free a block that came from heap h
+ */
+void mm_heap_free(mm_heap_t *h, void *bp)
 {
     size_t size;
+    int i;
+
+    if ( bp == NULL )
+        return;
+
     // slight optimization. If it's already freed, skip the coalescing
     if ( GET_ALLOC(HDRP(bp)) == 0 )
         return;
 
     size = GET_SIZE(HDRP(bp));
 
+    // quick sizes keep the block as it is for the next request
+    for (i = 0; i < h->nquick; i++)
+    {
+        if ( h->quick[i].size == size )
+        {
+            *(char **)bp = h->quick[i].head;
+            h->quick[i].head = bp;
+            h->quick[i].len++;
+            if ( h->quick[i].live > 0 )
+                h->quick[i].live--;
+            if ( h->maint && h->quick[i].len > h->quick[i].hits + IDLE_BATCH )
+                __atomic_fetch_or(&h->work, WORK_TRIM, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+
+    // large blocks wait in the zero pool for the maintenance thread
+    if ( h->maint && size >= ZERO_MIN && h->zero_bytes + size <= ZERO_POOL_MAX )
+    {
+        *(char **)bp = h->zero_pool;
+        h->zero_pool = bp;
+        h->zero_bytes += size;
+        __atomic_fetch_or(&h->work, WORK_ZERO, __ATOMIC_RELEASE);
+        return;
+    }
+
     PUT_HDR_FTR(bp, size, 0);
-    coalesce(bp);
+    coalesce(h, bp);
 
     CHECK_HEAP("Freed bp: %p", bp);
 }
 
+/*
+ * mm_free_sized - Free a block whose requested size the caller still knows
+ *     (C++ sized delete). The block's size can't be worked out from it:
+ *     place() leaves remainders too small to split inside the block, and
+ *     mm_memalign moves block starts. So the header is still read, this
+ *     costs the same as mm_free, and size only feeds a debug check.
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+#if DEBUG
+    if ( bp != NULL )
+        assert(GET_SIZE(HDRP(bp)) >= size + DSIZE);
+#endif
+    mm_free(bp);
+}
+
+/*
+ * mm_usable_size - Number of payload bytes in the block at bp, which is
+ *     at least what was asked for
+ */
+size_t mm_usable_size(void *bp)
+{
+    if ( bp == NULL )
+        return 0;
+
+    return GET_SIZE(HDRP(bp)) - DSIZE;
+}
+
+/*
+ * mm_memalign - Allocate size bytes aligned to alignment, a power of two.
+ *     Over-allocates by alignment - ALIGNMENT, then moves the block start
+ *     up to the first aligned address. The bytes skipped over are handed
+ *     to the previous block, allocated or free, so no tiny free block is
+ *     left in front; any slack at the end goes back to the heap.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    void *bp;
+
+    HEAP_LOCK();
+    bp = mm_heap_memalign(&default_heap, alignment, size);
+    HEAP_UNLOCK();
+    return bp;
+}
+
+/*
+ * mm_heap_memalign - mm_memalign from heap h
+ */
+void *mm_heap_memalign(mm_heap_t *h, size_t alignment, size_t size)
+{
+    char *bp, *abp, *prev;
+    size_t adj_size, blk_size, lead, prev_size, prev_alloc;
+
+    if ( alignment <= ALIGNMENT )
+        return mm_heap_malloc(h, size);
+
+    if ( size == 0 || (alignment & (alignment - 1)) != 0 )
+        return NULL;
+
+    if ( size <= DSIZE )
+        adj_size = 2 * DSIZE;
+    else
+        adj_size = DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
+
+    if ((bp = mm_heap_malloc(h, size + alignment - ALIGNMENT)) == NULL)
+        return NULL;
+
+    abp = (char *)(((uintptr_t)bp + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    if ( abp != bp )
+    {
+        lead = abp - bp;
+        prev = PREV_BLKP(bp);
+        blk_size = GET_SIZE(HDRP(bp));
+
+        prev_size = GET_SIZE(HDRP(prev)) + lead;
+        prev_alloc = GET_ALLOC(HDRP(prev));
+
+        PUT_HDR_FTR(prev, prev_size, prev_alloc);
+        PUT_HDR_FTR(abp, blk_size - lead, 1);
+
+        // bp no longer starts a block
+        if ( h->last_find == bp )
+            h->last_find = abp;
+    }
+
+    // Trim the tail, which may border another free block
+    place(abp, adj_size);
+    if ( !GET_ALLOC(HDRP(NEXT_BLKP(abp))) )
+        coalesce(h, NEXT_BLKP(abp));
+
+    CHECK_HEAP("Memalign size: %zu(%zu), alignment: %zu, bp: %p", size, adj_size, alignment, abp);
+    return abp;
+}
 
-inline static void *coalesce(void *bp)
+inline static void *coalesce(mm_heap_t *h, void *bp)
 {
     size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
@@ -268,8 +768,8 @@ inline static void *coalesce(void *bp)
     {
         // if the last_find pointer was at the coalesced block, point 
         // to the block after next
-        if ( last_find == NEXT_BLKP(bp) )
-            last_find = NEXT_BLKP(NEXT_BLKP(bp));
+        if ( h->last_find == NEXT_BLKP(bp) )
+            h->last_find = NEXT_BLKP(NEXT_BLKP(bp));
 
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
 
@@ -280,8 +780,8 @@ inline static void *coalesce(void *bp)
     {
         // if the last_find pointer is pointing to bp, set it to point
         // to the next block
-        if ( last_find == bp )
-            last_find = NEXT_BLKP(bp);
+        if ( h->last_find == bp )
+            h->last_find = NEXT_BLKP(bp);
 
         size += GET_SIZE(FTRP(PREV_BLKP(bp)));
         PUT(FTRP(bp), PACK(size, 0));
@@ -293,8 +793,8 @@ inline static void *coalesce(void *bp)
     {
         // if the last_find pointer is in coalesced block, point 
         // to the block after next
-        if ( last_find == NEXT_BLKP(bp) || last_find == bp )
-            last_find = NEXT_BLKP(NEXT_BLKP(bp));
+        if ( h->last_find == NEXT_BLKP(bp) || h->last_find == bp )
+            h->last_find = NEXT_BLKP(NEXT_BLKP(bp));
 
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
         PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
@@ -308,21 +808,36 @@ inline static void *coalesce(void *bp)
  * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
  */
 void *mm_realloc(void *bp, size_t size)
+{
+    void *new_bp;
+
+    HEAP_LOCK();
+    new_bp = mm_heap_realloc(&default_heap, bp, size);
+    HEAP_UNLOCK();
+    return new_bp;
+}
+
+/*
+ * mm_heap_realloc - mm_realloc a block that came from heap h
+ */
+void *mm_heap_realloc(mm_heap_t *h, void *bp, size_t size)
 {
     void *new_bp;
     size_t adj_size;
-    size_t old_size = GET_SIZE(HDRP(bp));
+    size_t old_size;
 
     // Edge cases
     if (bp == NULL)
-        return mm_malloc(size);
+        return mm_heap_malloc(h, size);
 
     if (size == 0)
     {
-        mm_free(bp);
+        mm_heap_free(h, bp);
         return NULL;
     }
 
+    old_size = GET_SIZE(HDRP(bp));
+
     // Adjust size to be word aligned and at least big enough for header/footer
     if ( size <= DSIZE )
         adj_size = 2 * DSIZE;
@@ -336,15 +851,20 @@ void *mm_realloc(void *bp, size_t size)
     // Free current block
     PUT_HDR_FTR(bp, old_size, 0);
 
-    new_bp = coalesce(bp);
+    new_bp = coalesce(h, bp);
     if ( GET_SIZE(HDRP(new_bp)) < adj_size)
     {
         // not enough free space around block, need to find new block
-        if ((new_bp = find_fit(adj_size)) == NULL)
+        if ((new_bp = find_fit(h, adj_size)) == NULL)
         {
             // Still can't find big enough block. Need to expand the heap
-            if ((new_bp = extend_heap(MAX(adj_size, CHUNK_SIZE)/WSIZE)) == NULL)
+            if ((new_bp = extend_heap(h, MAX(adj_size, CHUNK_SIZE)/WSIZE)) == NULL &&
+                (new_bp = malloc_under_pressure(h, adj_size)) == NULL)
+            {
+                // Out of memory. The old block has to survive as it was.
+                restore_block(h, bp, old_size);
                 return NULL;
+            }
         }
     }
 
@@ -362,13 +882,659 @@ void *mm_realloc(void *bp, size_t size)
     return new_bp;
 }
 
+/*
+ * restore_block - Undo the speculative free in a failed mm_realloc. Only
+ *     header and footer words were touched, so the payload at bp is still
+ *     intact inside whatever free block now covers it; split that block
+ *     back up around bp.
+ */
+static void restore_block(mm_heap_t *h, void *bp, size_t size)
+{
+    char *fbp = NEXT_BLKP(h->heap_listp);
+    char *end;
+
+    // find the free block covering bp
+    while (NEXT_BLKP(fbp) <= (char *)bp)
+        fbp = NEXT_BLKP(fbp);
+    end = NEXT_BLKP(fbp);
+
+    if (fbp < (char *)bp)
+    {
+        PUT_HDR_FTR(fbp, (char *)bp - fbp, 0);
+    }
+
+    PUT_HDR_FTR(bp, size, 1);
+
+    if (end > (char *)bp + size)
+    {
+        PUT_HDR_FTR((char *)bp + size, end - ((char *)bp + size), 0);
+    }
+
+    CHECK_HEAP("Restored bp: %p after failed realloc", bp);
+}
+
+/*
+ * quick_sample - Count a request for a block of size bytes, and review
+ *     the quick classes at the end of an epoch. Sizes that don't find a
+ *     slot within a few probes go uncounted.
+ */
+static void quick_sample(mm_heap_t *h, size_t size)
+{
+    unsigned int i = ((unsigned int)(size / DSIZE) * 2654435761u) >> (32 - SAMPLE_BITS);
+    int probe;
+
+    for (probe = 0; probe < 4; probe++, i = (i + 1) & (SAMPLE_SLOTS - 1))
+    {
+        if ( h->samples[i].size == size )
+        {
+            h->samples[i].count++;
+            break;
+        }
+        if ( h->samples[i].size == 0 )
+        {
+            h->samples[i].size = size;
+            h->samples[i].count = 1;
+            break;
+        }
+    }
+
+    if ( --h->epoch_left == 0 )
+    {
+        if ( h->maint )
+        {
+            // the review may be a while; don't let the count wrap meanwhile
+            h->epoch_left = QUICK_EPOCH;
+            __atomic_fetch_or(&h->work, WORK_REVIEW, __ATOMIC_RELEASE);
+        }
+        else
+            quick_review(h);
+    }
+}
+
+/*
+ * quick_review - Make the epoch's most requested sizes the quick classes:
+ *     retire classes that are no longer among them, then add the new ones
+ *     with empty lists.
+ */
+static void quick_review(mm_heap_t *h)
+{
+    size_t top[QUICK_MAX];
+    unsigned int top_count[QUICK_MAX];
+    int ntop = 0;
+    int i, j, k;
+
+    // top sizes by count, each over the share threshold, kept sorted
+    for (i = 0; i < SAMPLE_SLOTS; i++)
+    {
+        unsigned int count = h->samples[i].count;
+
+        if ( count < QUICK_EPOCH / QUICK_SHARE ||
+             (ntop == h->quick_max && count <= top_count[ntop-1]) )
+            continue;
+
+        j = (ntop < h->quick_max) ? ntop++ : ntop - 1;
+        for (; j > 0 && top_count[j-1] < count; j--)
+        {
+            top[j] = top[j-1];
+            top_count[j] = top_count[j-1];
+        }
+        top[j] = h->samples[i].size;
+        top_count[j] = count;
+    }
+
+    for (i = 0; i < h->nquick; )
+    {
+        for (k = 0; k < ntop && top[k] != h->quick[i].size; k++)
+            ;
+        if ( k < ntop )
+        {
+            top[k] = 0;     // already a class
+            h->quick[i++].hits = 0;
+            continue;
+        }
+
+        // gone cold; the maintenance thread frees the blocks in steps
+        if ( h->maint && h->ndeferred < QUICK_MAX )
+        {
+            h->deferred[h->ndeferred++] = h->quick[i];
+            __atomic_fetch_or(&h->work, WORK_DRAIN, __ATOMIC_RELEASE);
+        }
+        else
+            quick_release(h, &h->quick[i], h->quick[i].len);
+        h->quick[i] = h->quick[--h->nquick];
+        h->quick_retired++;
+    }
+
+    for (k = 0; k < ntop; k++)
+    {
+        if ( top[k] == 0 )
+            continue;
+        h->quick[h->nquick].size = top[k];
+        h->quick[h->nquick].head = NULL;
+        h->quick[h->nquick].len = 0;
+        h->quick[h->nquick].hits = 0;
+        h->quick[h->nquick].live = 0;
+        h->quick[h->nquick].peak = 0;
+        h->nquick++;
+        h->quick_added++;
+    }
+
+    memset(h->samples, 0, sizeof(h->samples));
+    h->epoch_left = QUICK_EPOCH;
+}
+
+/*
+ * quick_release - Really free up to n blocks from quick class q. Returns
+ *     nonzero if there were any.
+ */
+static int quick_release(mm_heap_t *h, struct quick_class *q, unsigned int n)
+{
+    char *bp;
+    size_t size;
+    int released = 0;
+
+    while (n-- > 0 && (bp = q->head) != NULL)
+    {
+        q->head = *(char **)bp;
+        q->len--;
+
+        size = GET_SIZE(HDRP(bp));
+        PUT_HDR_FTR(bp, size, 0);
+        coalesce(h, bp);
+        released = 1;
+    }
+
+    return released;
+}
+
+/*
+ * mm_idle - Called when the application has time to spare. Does a small,
+ *     bounded amount of deferred work and returns nonzero if it did any:
+ *     quick lists holding more blocks than their class used this epoch
+ *     give some back. With quick classes off there is nothing to do.
+ */
+int mm_idle(void)
+{
+    int did;
+
+    HEAP_LOCK();
+    did = mm_heap_idle(&default_heap);
+    HEAP_UNLOCK();
+    return did;
+}
+
+int mm_heap_idle(mm_heap_t *h)
+{
+    struct quick_class *q;
+    int i;
+
+    for (i = 0; i < h->nquick; i++)
+    {
+        q = &h->quick[i];
+        if ( q->len > q->hits )
+        {
+            unsigned int n = q->len - q->hits;
+            return quick_release(h, q, n < IDLE_BATCH ? n : IDLE_BATCH);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * mm_set_quick_classes - How many quick classes heaps set up from now on
+ *     may use, at most MM_QUICK_MAX; 0, the default, turns them off
+ */
+void mm_set_quick_classes(int n)
+{
+    quick_classes = (n < 0) ? 0 : (n > QUICK_MAX) ? QUICK_MAX : n;
+}
+
+/*
+ * mm_get_stats - Counters of the default heap
+ */
+void mm_get_stats(mm_stats_t *stats)
+{
+    HEAP_LOCK();
+    mm_heap_get_stats(&default_heap, stats);
+    HEAP_UNLOCK();
+}
+
+void mm_heap_get_stats(mm_heap_t *h, mm_stats_t *stats)
+{
+    int i;
+
+    stats->heapsize = mem_region_heapsize(h->region);
+    stats->quick_hits = h->quick_hits;
+    stats->quick_added = h->quick_added;
+    stats->quick_retired = h->quick_retired;
+    stats->nquick = h->nquick;
+    stats->maint_steps = h->maint_steps;
+    stats->maint_usecs = __atomic_load_n(&h->maint_ns, __ATOMIC_RELAXED) / 1000;
+    stats->calloc_pooled = h->calloc_pooled;
+    stats->calloc_cleared = h->calloc_cleared;
+    stats->zeroed_bytes = h->zeroed_bytes;
+    for (i = 0; i < h->nquick; i++)
+    {
+        stats->quick_size[i] = h->quick[i].size - DSIZE;
+        stats->quick_peak[i] = h->quick[i].peak;
+    }
+}
+
+/*
+ * mm_start_maintenance - Start a thread that does the default heap's
+ *     maintenance in the background, using at most budget percent of
+ *     its time, at the lowest scheduling priority the system allows.
+ *     mm_init stops it; stop it yourself before resetting the heap.
+ *     Apart from clearing the zero pool, its work is the quick classes',
+ *     so it has little to do with them off. Returns -1 if the thread
+ *     can't be started.
+ */
+int mm_start_maintenance(int budget)
+{
+    pthread_mutexattr_t attr;
+
+    if ( default_heap.maint )
+        return 0;
+
+    // recursive, since a pressure handler may call mm_free from mm_malloc
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&maint_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    maint_budget = (budget < 1) ? 1 : (budget > 100) ? 100 : budget;
+    maint_stop = 0;
+    default_heap.maint = 1;
+    if (pthread_create(&maint_thread, NULL, maint_main, &default_heap) != 0)
+    {
+        default_heap.maint = 0;
+        pthread_mutex_destroy(&maint_lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * mm_stop_maintenance - Stop the maintenance thread, if there is one, and
+ *     finish its outstanding work inline
+ */
+void mm_stop_maintenance(void)
+{
+    mm_heap_t *h = &default_heap;
+
+    if ( !h->maint )
+        return;
+
+    maint_halt(h);
+    zero_release(h);
+    for (; h->ndeferred > 0; h->ndeferred--)
+        quick_release(h, &h->deferred[h->ndeferred-1], h->deferred[h->ndeferred-1].len);
+    if ( h->work & WORK_REVIEW )
+        quick_review(h);
+    h->work = 0;
+}
+
+static void maint_halt(mm_heap_t *h)
+{
+    if ( !h->maint )
+        return;
+
+    __atomic_store_n(&maint_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(maint_thread, NULL);
+    h->maint = 0;
+    pthread_mutex_destroy(&maint_lock);
+}
+
+static unsigned long long maint_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * maint_main - The maintenance thread. Each period it takes steps while
+ *     there is work and budget left, holding the heap lock for one step at
+ *     a time, then sleeps out the rest of the period.
+ */
+static void *maint_main(void *arg)
+{
+    mm_heap_t *h = arg;
+    unsigned long long start, now, budget_ns = MAINT_PERIOD / 100 * maint_budget;
+    struct timespec ts;
+    int did;
+
+#ifdef SCHED_IDLE
+    struct sched_param param = { 0 };
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+    while ( !__atomic_load_n(&maint_stop, __ATOMIC_ACQUIRE) )
+    {
+        start = now = maint_now();
+        while ( now - start < budget_ns && __atomic_load_n(&h->work, __ATOMIC_ACQUIRE) )
+        {
+            pthread_mutex_lock(&maint_lock);
+            if ((did = maint_step(h)))
+                h->maint_steps++;
+            pthread_mutex_unlock(&maint_lock);
+            now = maint_now();
+            if ( !did )
+                break;
+        }
+        __atomic_fetch_add(&h->maint_ns, now - start, __ATOMIC_RELAXED);
+
+        if ( now - start < MAINT_PERIOD )
+        {
+            ts.tv_sec = 0;
+            ts.tv_nsec = MAINT_PERIOD - (now - start);
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * maint_step - One bounded piece of published work, with the heap locked:
+ *     free a batch of a retired class's blocks, review the quick classes,
+ *     or trim a batch off a quick list. Returns nonzero if it did any.
+ */
+static int maint_step(mm_heap_t *h)
+{
+    struct quick_class *q;
+
+    if ( h->ndeferred > 0 )
+    {
+        q = &h->deferred[h->ndeferred-1];
+        quick_release(h, q, IDLE_BATCH);
+        if ( q->head == NULL )
+            h->ndeferred--;
+        return 1;
+    }
+    __atomic_fetch_and(&h->work, ~WORK_DRAIN, __ATOMIC_RELAXED);
+
+    if ( h->work & WORK_REVIEW )
+    {
+        __atomic_fetch_and(&h->work, ~WORK_REVIEW, __ATOMIC_RELAXED);
+        quick_review(h);
+        return 1;
+    }
+
+    if ( h->work & WORK_TRIM )
+    {
+        __atomic_fetch_and(&h->work, ~WORK_TRIM, __ATOMIC_RELAXED);
+        if (mm_heap_idle(h))
+            return 1;
+    }
+
+    if ( h->work & WORK_ZERO )
+    {
+        if (zero_step(h))
+            return 1;
+        __atomic_fetch_and(&h->work, ~WORK_ZERO, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+/*
+ * zero_step - Clear up to ZERO_STEP bytes of the first pool block not yet
+ *     zeroed, and mark it once it's done. Returns zero if every block in
+ *     the pool already is.
+ */
+static int zero_step(mm_heap_t *h)
+{
+    char *bp = h->zeroing;
+    size_t payload, n;
+
+    if ( bp == NULL )
+    {
+        for (bp = h->zero_pool; bp != NULL && GET_ZEROED(HDRP(bp)); bp = *(char **)bp)
+            ;
+        if ( bp == NULL )
+            return 0;
+        h->zeroing = bp;
+        h->zero_done = sizeof(char *);      // past the link word
+    }
+
+    payload = GET_SIZE(HDRP(bp)) - DSIZE;
+    n = MIN(payload - h->zero_done, ZERO_STEP);
+    zero_fill(bp + h->zero_done, n);
+    h->zero_done += n;
+    h->zeroed_bytes += n;
+
+    if ( h->zero_done == payload )
+    {
+        PUT(HDRP(bp), GET(HDRP(bp)) | 0x2);
+        PUT(FTRP(bp), GET(FTRP(bp)) | 0x2);
+        h->zeroing = NULL;
+    }
+
+    return 1;
+}
+
+/*
+ * zero_fill - memset(p, 0, n) with non-temporal stores where the compiler
+ *     offers them, fenced so the zeroes are visible before the block is
+ *     handed out
+ */
+static void zero_fill(char *p, size_t n)
+{
+#ifdef __SSE2__
+    char *end = p + n;
+    char *lo = (char *)(((uintptr_t)p + 15) & ~(uintptr_t)15);
+    char *hi = (char *)((uintptr_t)end & ~(uintptr_t)15);
+
+    if ( hi <= lo )
+    {
+        memset(p, 0, n);
+        return;
+    }
+
+    memset(p, 0, lo - p);
+    for (; lo < hi; lo += 16)
+        _mm_stream_si128((__m128i *)lo, _mm_setzero_si128());
+    _mm_sfence();
+    memset(hi, 0, end - hi);
+#else
+    memset(p, 0, n);
+#endif
+}
+
+/*
+ * zero_take - Take the first block of at least size bytes out of the
+ *     zero pool, only cleared ones if zeroed is set, and allocate size
+ *     bytes of it; the excess goes back to the heap. Returns NULL if
+ *     nothing fits.
+ */
+static char *zero_take(mm_heap_t *h, size_t size, int zeroed)
+{
+    char *bp, **link;
+    size_t blk_size;
+
+    for (link = &h->zero_pool; (bp = *link) != NULL; link = (char **)bp)
+    {
+        if ( (zeroed && !GET_ZEROED(HDRP(bp))) || GET_SIZE(HDRP(bp)) < size )
+            continue;
+
+        *link = *(char **)bp;
+        if ( h->zeroing == bp )
+            h->zeroing = NULL;
+        blk_size = GET_SIZE(HDRP(bp));
+        h->zero_bytes -= blk_size;
+
+        PUT_HDR_FTR(bp, blk_size, 1);
+        place(bp, size);
+        if ( GET_SIZE(HDRP(bp)) < blk_size )
+            coalesce(h, NEXT_BLKP(bp));
+        return bp;
+    }
+
+    return NULL;
+}
+
+/*
+ * zero_release - Give every block in the zero pool back to the heap.
+ *     Returns nonzero if there were any.
+ */
+static int zero_release(mm_heap_t *h)
+{
+    char *bp;
+    size_t size;
+    int released = 0;
+
+    while ((bp = h->zero_pool) != NULL)
+    {
+        h->zero_pool = *(char **)bp;
+        size = GET_SIZE(HDRP(bp));
+        PUT_HDR_FTR(bp, size, 0);
+        coalesce(h, bp);
+        released = 1;
+    }
+    h->zero_bytes = 0;
+    h->zeroing = NULL;
+
+    return released;
+}
+
+/*
+ * mm_calloc - Allocate zeroed space for nmemb objects of size bytes each
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+
+    HEAP_LOCK();
+    bp = mm_heap_calloc(&default_heap, nmemb, size);
+    HEAP_UNLOCK();
+    return bp;
+}
+
+/*
+ * mm_heap_calloc - mm_calloc from heap h. Large requests take the first
+ *     cleared block that fits from the zero pool, giving any excess back
+ *     to the heap; the rest are cleared here.
+ */
+void *mm_heap_calloc(mm_heap_t *h, size_t nmemb, size_t size)
+{
+    size_t bytes, adj_size;
+    char *bp;
+
+    if ( nmemb != 0 && size > (size_t)-1 / nmemb )
+        return NULL;
+    bytes = nmemb * size;
+    adj_size = DSIZE * ((bytes + (DSIZE) + (DSIZE - 1)) / DSIZE);
+
+    if ( adj_size >= ZERO_MIN && (bp = zero_take(h, adj_size, 1)) != NULL )
+    {
+        *(char **)bp = NULL;                // the only word left dirty
+        h->calloc_pooled++;
+        return bp;
+    }
+
+    if ((bp = mm_heap_malloc(h, bytes)) != NULL)
+    {
+        memset(bp, 0, bytes);
+        h->calloc_cleared++;
+    }
+    return bp;
+}
+
+/*
+ * mm_set_warm_profile - Warm up heaps set up from now on, mm_init's
+ *     included, from profile: the mm_get_stats() of an earlier run. The
+ *     quick classes it lists start out live, with their lists already
+ *     holding as many blocks as the run ever had out at once. NULL goes
+ *     back to a cold start. A heap only starts warm if quick classes are
+ *     on (mm_set_quick_classes); with none, the profile is ignored.
+ */
+void mm_set_warm_profile(const mm_stats_t *profile)
+{
+    if ( profile != NULL )
+        warm_profile = *profile;
+    warm_profile_set = (profile != NULL);
+}
+
+/*
+ * warm_start - Grow a new heap in one extension, by half of the profiled
+ *     heap size or by the profile's blocks plus a chunk if that's more,
+ *     and carve those blocks off the front onto their quick lists. The
+ *     extension is capped at WARM_MAX bytes, and if the region can't
+ *     take it the heap starts cold. A class's hits start at its block count so that mm_idle
+ *     leaves the lists alone until the first review.
+ */
+static int warm_start(mm_heap_t *h, const mm_stats_t *profile)
+{
+    unsigned int count[QUICK_MAX];
+    struct quick_class *q;
+    size_t total = 0;
+    size_t size, avail;
+    char *bp;
+    int i;
+    unsigned int j;
+
+    for (i = 0; i < profile->nquick && h->nquick < h->quick_max; i++)
+    {
+        size = profile->quick_size[i] + DSIZE;
+        if ( profile->quick_peak[i] == 0 || total + size > WARM_MAX )
+            continue;
+
+        count[h->nquick] = MIN(profile->quick_peak[i], (WARM_MAX - total) / size);
+        total += count[h->nquick] * size;
+
+        q = &h->quick[h->nquick++];
+        q->size = size;
+        q->head = NULL;
+        q->len = q->live = q->peak = 0;
+        h->quick_added++;
+    }
+
+    // room for half the heap the profiled run grew to, so next fit
+    // doesn't walk the carved blocks every time a chunk runs out
+    size = MIN(MAX(profile->heapsize / 2, total + CHUNK_SIZE), WARM_MAX);
+    if ((bp = extend_heap(h, MAX(size, total + CHUNK_SIZE)/WSIZE)) == NULL)
+    {
+        // no room for it; start cold
+        h->nquick = 0;
+        h->quick_added = 0;
+        return (extend_heap(h, CHUNK_SIZE/WSIZE) == NULL) ? -1 : 0;
+    }
+    avail = GET_SIZE(HDRP(bp));
+
+    for (i = 0; i < h->nquick; i++)
+    {
+        q = &h->quick[i];
+        size = q->size;
+        for (j = 0; j < count[i]; j++)
+        {
+            PUT_HDR_FTR(bp, size, 1);
+            *(char **)bp = q->head;
+            q->head = bp;
+            h->last_find = bp;
+            bp = NEXT_BLKP(bp);
+        }
+        q->len = q->hits = count[i];
+        avail -= count[i] * size;
+    }
+
+    // next fit starts past the last carved block, at the free rest
+    PUT_HDR_FTR(bp, avail, 0);
+
+    return 0;
+}
+
 #if DEBUG
-void check_heap(const char *title, ...)
+void check_heap(mm_heap_t *h, const char *title, ...)
 {
     int i = 0;                      // block counter;
+    char *heap_listp = h->heap_listp;
     void *bp = NEXT_BLKP(heap_listp);
-    void *heap_lo = mem_heap_lo();
-    void *heap_hi = mem_heap_hi();
+    void *heap_lo = mem_region_lo(h->region);
+    void *heap_hi = mem_region_hi(h->region);
 
     if ( title != NULL )
     {
@@ -387,9 +1553,9 @@ void check_heap(const char *title, ...)
         "last_findp:\t%p\n",
         heap_lo,
         heap_hi,
-        mem_heapsize(),
-        (void *)((void *)heap_listp - mem_heap_lo()),
-        last_find);
+        mem_region_heapsize(h->region),
+        (void *)((void *)heap_listp - heap_lo),
+        h->last_find);
 
     printf(
         "0x%#.8x\n"
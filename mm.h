@@ -1,9 +1,64 @@
 #include <stdio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void mm_free_sized(void *ptr, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern int mm_idle (void);
+
+/* Adaptive exact-size quick classes, and counters */
+#define MM_QUICK_MAX 4
+
+typedef struct {
+    size_t heapsize;      /* bytes taken from memlib */
+    size_t quick_hits;    /* mallocs served from a quick list */
+    size_t quick_added;   /* quick classes made */
+    size_t quick_retired; /* quick classes retired when they went cold */
+    int nquick;           /* quick classes now */
+    size_t quick_size[MM_QUICK_MAX]; /* their payload sizes */
+    unsigned int quick_peak[MM_QUICK_MAX]; /* most of each out at once */
+    size_t maint_steps;   /* work steps done by the maintenance thread */
+    size_t maint_usecs;   /* time it spent on them */
+    size_t calloc_pooled; /* mm_callocs served from the zero pool */
+    size_t calloc_cleared;/* mm_callocs that cleared their own block */
+    size_t zeroed_bytes;  /* bytes the maintenance thread cleared */
+} mm_stats_t;
+
+extern void mm_set_quick_classes(int n);
+extern void mm_get_stats(mm_stats_t *stats);
+extern void mm_set_warm_profile(const mm_stats_t *profile);
+extern int mm_start_maintenance(int budget);
+extern void mm_stop_maintenance(void);
+
+typedef int (*mm_pressure_fn)(size_t size);
+extern void mm_set_pressure_handler(mm_pressure_fn handler);
+
+/*
+ * Explicit heaps. Each one owns a memlib region; the functions above work
+ * on a default heap in the default region. Blocks must go back to the
+ * heap they came from.
+ */
+typedef struct mm_heap mm_heap_t;
+struct mem_region;
+
+extern mm_heap_t *mm_heap_create(struct mem_region *region);
+extern void mm_heap_destroy(mm_heap_t *h);
+extern void *mm_heap_malloc(mm_heap_t *h, size_t size);
+extern void mm_heap_free(mm_heap_t *h, void *ptr);
+extern void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size);
+extern void *mm_heap_memalign(mm_heap_t *h, size_t alignment, size_t size);
+extern void *mm_heap_calloc(mm_heap_t *h, size_t nmemb, size_t size);
+extern void mm_heap_set_pressure_handler(mm_heap_t *h, mm_pressure_fn handler);
+extern int mm_heap_idle(mm_heap_t *h);
+extern void mm_heap_get_stats(mm_heap_t *h, mm_stats_t *stats);
 
 
 /* 
@@ -19,4 +74,8 @@ typedef struct {
     char *id2;      /* login ID of second member */
 } team_t;
 
-extern team_t team;
\ No newline at end of file
+extern team_t team;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,130 @@
+/*
+ * mm_cxx.h - C++ access to the mm malloc package
+ *
+ * mm_allocator<T> plugs mm into STL containers, and mm_memory_resource
+ * does the same for std::pmr containers. Neither one locks: like mm
+ * itself, they are meant for single-threaded use. Link mm_new.o as well
+ * to send every global new and delete to mm. Code that may reach mm from
+ * several threads (global new, pool slab refills) holds mm_cxx_lock().
+ */
+#ifndef __MM_CXX_H_
+#define __MM_CXX_H_
+
+#include <cstddef>
+#include <new>
+#include <memory_resource>
+#include <mutex>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* Alignment mm_malloc always provides */
+const std::size_t mm_alignment = 8;
+
+/*
+ * mm_cxx_init - Set up memlib and mm the first time any C++ entry point
+ *     needs them. Programs that call mem_init/mm_init themselves (like
+ *     mdriver) should not use this.
+ */
+inline bool mm_cxx_init()
+{
+    static const bool ok = (mem_init(), mm_init() == 0);
+    return ok;
+}
+
+/*
+ * mm_cxx_lock - The one lock shared by every C++ entry point that locks
+ */
+inline std::mutex &mm_cxx_lock()
+{
+    static std::mutex lock;
+    return lock;
+}
+
+/*
+ * mm_cxx_alloc - Allocate bytes aligned to align from mm, or NULL
+ */
+inline void *mm_cxx_alloc(std::size_t bytes, std::size_t align)
+{
+    if (bytes == 0)
+        bytes = 1;
+    return (align > mm_alignment) ? mm_memalign(align, bytes)
+                                  : mm_malloc(bytes);
+}
+
+/*
+ * mm_allocator - STL allocator drawing from the mm heap. Every instance
+ *     shares the one heap, so all of them compare equal.
+ */
+template <class T>
+class mm_allocator {
+public:
+    typedef T value_type;
+
+    mm_allocator() noexcept { mm_cxx_init(); }
+    template <class U> mm_allocator(const mm_allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        if (n > std::size_t(-1) / sizeof(T))
+            throw std::bad_array_new_length();
+        void *p = mm_cxx_alloc(n * sizeof(T), alignof(T));
+        if (p == NULL)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept
+    {
+        mm_free_sized(p, n * sizeof(T));
+    }
+};
+
+template <class T, class U>
+inline bool operator==(const mm_allocator<T> &, const mm_allocator<U> &)
+{
+    return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const mm_allocator<T> &, const mm_allocator<U> &)
+{
+    return false;
+}
+
+/*
+ * mm_memory_resource - std::pmr::memory_resource backed by the mm heap.
+ *     Use mm_memory_resource::get() rather than making new instances.
+ */
+class mm_memory_resource : public std::pmr::memory_resource {
+public:
+    static mm_memory_resource *get()
+    {
+        static mm_memory_resource resource;
+        return &resource;
+    }
+
+private:
+    mm_memory_resource() { mm_cxx_init(); }
+
+    void *do_allocate(std::size_t bytes, std::size_t align) override
+    {
+        void *p = mm_cxx_alloc(bytes, align);
+        if (p == NULL)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t) override
+    {
+        mm_free_sized(p, bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override
+    {
+        return this == &other;
+    }
+};
+
+#endif /* __MM_CXX_H_ */
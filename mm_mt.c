@@ -0,0 +1,1223 @@
+/*
+ * mm_mt.c - Thread-safe allocator with per-thread heaps (Hoard-style)
+ *
+ * OVERVIEW
+ * Heap 0 is the global heap and heaps 1..nheaps are thread heaps; threads
+ * are handed thread heaps round robin the first time they allocate. Each
+ * heap owns a set of superblocks, SB_SIZE bytes each and aligned to
+ * SB_SIZE, so the superblock holding any small block is found by masking
+ * the block's address. A superblock starts with a header and is carved
+ * into objects of one size class; freed objects go on its free list.
+ *
+ * Within a heap, the superblocks of each size class are kept in buckets by
+ * how full they are: bucket 0 holds empty superblocks, buckets 1-4 those up
+ * to a quarter, half, three quarters and not quite full, and the last
+ * bucket the full ones. Allocation takes from the fullest superblock that
+ * has room, which packs live objects together and lets the rest empty out.
+ *
+ * BOUNDING BLOWUP
+ * With u bytes in use and a bytes of superblocks held by a thread heap,
+ * the heap must keep
+ *
+ *     u >= a - SLACK_SBS * SB_SIZE   or   u >= (1 - f) * a
+ *
+ * where f is the empty fraction given to mm_mt_init. A free that breaks
+ * this moves the heap's emptiest superblock to the global heap, and a
+ * thread heap that runs out of room takes superblocks from the global
+ * heap before asking memlib for more. So memory freed by one thread can
+ * be reused by another instead of sitting idle in the heap that first
+ * allocated it.
+ *
+ * MAGAZINES
+ * In front of the heaps, each thread caches objects of every class in two
+ * magazines (Bonwick and Adams, "Magazines and Vmem", 2001): arrays of up
+ * to a fixed number of objects, loaded and previous, where previous is
+ * always full or empty. Allocation and free work on the loaded magazine
+ * without any lock until both are empty (or full). Then the thread trades
+ * with the class's depot, which keeps full and empty magazines under a
+ * lock held for a few instructions, or failing that fills a magazine from
+ * its heap or empties one into the heaps in one batch. A thread's cache
+ * is emptied back into the heaps when the thread exits.
+ *
+ * How many objects a thread's magazines hold adapts per class: a class
+ * that keeps missing has its limit doubled, and one left idle for a
+ * whole decay window has it halved, with the excess objects given back.
+ * A thread that stops allocating altogether can't run its own decay, so
+ * every decay check also empties the caches of threads that have done
+ * nothing for IDLE_EPOCHS windows of the others' work.
+ *
+ * Limits are reserved against a global cap on cache memory, and so are
+ * the objects in full magazines parked in the depots; a limit can't
+ * grow, and a depot won't take a full magazine, once the cap is reached.
+ * A full magazine a thread takes from the depot is cut down to the
+ * thread's own limit.
+ *
+ * LOCKING
+ * Every heap has a lock, and a superblock may only change owner while
+ * both the old and new owner are locked. A thread heap is always locked
+ * before the global heap, and either before the sbrk lock. Freeing locks
+ * the superblock's owner and rechecks that it is still the owner. Depot
+ * locks are never held while taking a heap lock.
+ *
+ * A thread's cache has a lock word of its own, taken by the thread around
+ * every cached operation and by another thread emptying it for being
+ * idle. The other thread only ever tries it, while holding the registry
+ * lock of all caches.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "mm_mt.h"
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+
+#define SB_SIZE         (1<<14)     // bytes per superblock, and its alignment
+#define SB_HDR_SIZE     64          // room for a superblock_t, keeps objects 16-aligned
+#define SLACK_SBS       4           // superblocks a thread heap may always keep
+
+#define NUM_CLASSES     16
+#define SMALL_MAX       4096        // largest request served from superblocks
+#define NUM_BUCKETS     6
+#define FULL_BUCKET     (NUM_BUCKETS - 1)
+
+#define MAX_HEAPS       64
+
+#define MAG_BYTES       16384       // magazines hold up to this many bytes
+#define MAG_MIN         4           // ...but no fewer objects than this
+#define MAG_MAX         256         // ...or more than this
+#define GROW_MISSES     4           // misses in a window that double a limit
+#define DECAY_WINDOW    4096        // thread operations between decay checks
+#define IDLE_EPOCHS     2           // decay checks a cache may sit out unused
+#define CACHE_CAP       (1<<20)     // default bound on bytes reserved by caches
+#define DEPOT_MAX_FULL  8           // full magazines a depot keeps per class
+#define DEPOT_MAX_EMPTY 8           // empty magazines a depot keeps per class
+
+#define SB_OF(p)        ((superblock_t *)((uintptr_t)(p) & ~(uintptr_t)(SB_SIZE - 1)))
+
+static const size_t class_size[NUM_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256,
+    384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+
+struct mt_heap;
+
+typedef struct superblock {
+    struct mt_heap *owner;
+    struct superblock *prev;        // neighbours in the owner's bucket
+    struct superblock *next;
+    void *free_list;                // freed objects, linked through their first word
+    char *carve;                    // next object never handed out
+    size_t obj_size;
+    int sclass;
+    int nobjs;
+    int used;
+    int bucket;
+} superblock_t;
+
+typedef struct mt_heap {
+    pthread_mutex_t lock;
+    superblock_t *bins[NUM_CLASSES][NUM_BUCKETS];
+    size_t in_use;                  // bytes of objects handed out from here
+    size_t held;                    // bytes of superblocks owned
+} mt_heap_t;
+
+static mt_heap_t heaps[MAX_HEAPS + 1];
+static int num_heaps = 0;           // thread heaps; 0 until mm_mt_init
+static double empty_fraction;
+
+static unsigned char size_to_class[SMALL_MAX/16 + 1];
+
+// Superblocks come from one region, large blocks from an mm heap in another
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+static mem_region_t *sb_region = NULL;
+static char *sb_lo, *sb_end;        // fixed bounds of sb_region's storage
+static pthread_mutex_t large_lock = PTHREAD_MUTEX_INITIALIZER;
+static mem_region_t *large_region = NULL;
+static mm_heap_t *large_heap = NULL;
+
+// Thread to heap assignment; a new generation starts at every mm_mt_init
+static unsigned int generation = 0;
+static unsigned int next_heap = 0;
+static __thread mt_heap_t *my_heap = NULL;
+static __thread unsigned int my_generation = 0;
+
+// Magazines: an object cache per thread and size class, backed by depots
+typedef struct magazine {
+    struct magazine *next;          // in the depot
+    int rounds;                     // objects held
+    int capacity;
+    void *objs[];
+} magazine_t;
+
+typedef struct {
+    magazine_t *loaded;             // allocate from and free to this one
+    magazine_t *previous;           // always full or empty
+    int limit;                      // objects a magazine may hold; 0 if unused
+    int misses;                     // trips past the magazines this window
+    unsigned int last_use;          // my_tick at the last operation
+} mag_cache_t;
+
+// All of a thread's magazines, in the registry while the thread allocates
+typedef struct thread_cache {
+    mag_cache_t classes[NUM_CLASSES];
+    int lock;                       // held around cached operations
+    unsigned int last_epoch;        // decay_epoch at the last operation
+    struct thread_cache *prev;      // neighbours in the registry
+    struct thread_cache *next;
+} thread_cache_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    magazine_t *full;
+    magazine_t *empty;
+    int nfull;
+    int nempty;
+} depot_t;
+
+static int use_magazines = 1;       // for the next mm_mt_init
+static int magazines_on;
+static depot_t depots[NUM_CLASSES];
+static __thread thread_cache_t my_cache;
+static __thread unsigned int my_tick, my_decay_at;  // thread's operation clock
+static unsigned int decay_epoch;    // decay checks run by any thread
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_cache_t *registry = NULL;
+static size_t cache_cap = CACHE_CAP;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+// Statistics, updated atomically
+static size_t live_bytes, peak_live_bytes;
+static size_t sb_released, sb_reused;
+static size_t mag_fills, mag_swaps, mag_flushes;
+static size_t cache_reserved;       // bytes thread caches may hold, summed
+static size_t depot_bytes;          // bytes of objects in depot magazines
+static size_t class_limits[NUM_CLASSES];     // summed over running threads
+static size_t class_max_limit[NUM_CLASSES];
+static size_t class_misses[NUM_CLASSES];
+static size_t class_trims[NUM_CLASSES];
+
+static void *large_malloc(size_t size);
+static void large_free(void *bp);
+static void *heap_alloc(mt_heap_t *h, int c);
+static void heap_free_batch(void **objs, int n);
+static superblock_t *get_superblock(mt_heap_t *h, int sclass);
+static void release_superblock(mt_heap_t *h);
+static void *cache_alloc(int c);
+static void cache_free(void *bp, int c);
+static void cache_flush(mag_cache_t *mc, int c);
+static void cache_decay(void);
+static void cache_reclaim_idle(unsigned int epoch);
+static void depot_trim(void);
+static void cache_destroy(void *arg);
+
+static void make_cache_key(void)
+{
+    pthread_key_create(&cache_key, cache_destroy);
+}
+
+/*
+ * mm_mt_init - Set up nheaps thread heaps (at most MAX_HEAPS) and the
+ *     global heap. fraction is the f in the bound above; 0 keeps
+ *     superblocks in the thread heap that got them, for comparison.
+ *     Everything allocated before is released. Returns -1 on failure.
+ */
+int mm_mt_init(int nheaps, double fraction)
+{
+    int i, c;
+    size_t pad, sb_size;
+
+    if ( nheaps < 1 || nheaps > MAX_HEAPS )
+        return -1;
+
+    mm_mt_deinit();
+
+    // With f = 0 nothing moves superblocks between heaps, so give every
+    // heap room for a MAX_HEAP of its own
+    sb_size = (size_t)(nheaps + 1) * MAX_HEAP;
+    if ((sb_region = mem_region_create(sb_size)) == NULL ||
+        (large_region = mem_region_create(0)) == NULL ||
+        (large_heap = mm_heap_create(large_region)) == NULL)
+    {
+        mm_mt_deinit();
+        return -1;
+    }
+
+    sb_lo = mem_region_lo(sb_region);
+    sb_end = sb_lo + sb_size;
+
+    // Line the region's brk up with SB_SIZE so every superblock is aligned
+    pad = -(uintptr_t)sb_lo & (SB_SIZE - 1);
+    if ( pad != 0 && mem_region_sbrk(sb_region, pad) == (void *)-1 )
+    {
+        mm_mt_deinit();
+        return -1;
+    }
+
+    for (i = 0, c = 0; i <= SMALL_MAX/16; i++)
+    {
+        while (class_size[c] < (size_t)i * 16)
+            c++;
+        size_to_class[i] = c;
+    }
+
+    for (i = 0; i <= nheaps; i++)
+    {
+        memset(&heaps[i], 0, sizeof(mt_heap_t));
+        pthread_mutex_init(&heaps[i].lock, NULL);
+    }
+
+    for (c = 0; c < NUM_CLASSES; c++)
+    {
+        memset(&depots[c], 0, sizeof(depot_t));
+        pthread_mutex_init(&depots[c].lock, NULL);
+    }
+    pthread_once(&cache_key_once, make_cache_key);
+
+    magazines_on = use_magazines;
+    num_heaps = nheaps;
+    empty_fraction = fraction;
+    next_heap = 0;
+    generation++;
+    live_bytes = peak_live_bytes = 0;
+    sb_released = sb_reused = 0;
+    mag_fills = mag_swaps = mag_flushes = 0;
+    cache_reserved = 0;
+    depot_bytes = 0;
+    decay_epoch = 0;
+    registry = NULL;            // every thread registers again on first use
+    memset(class_limits, 0, sizeof(class_limits));
+    memset(class_max_limit, 0, sizeof(class_max_limit));
+    memset(class_misses, 0, sizeof(class_misses));
+    memset(class_trims, 0, sizeof(class_trims));
+    return 0;
+}
+
+/*
+ * mm_mt_set_magazines - Turn the per-thread magazine layer on or off from
+ *     the next mm_mt_init. It is on by default.
+ */
+void mm_mt_set_magazines(int on)
+{
+    use_magazines = on;
+}
+
+/*
+ * mm_mt_set_cache_cap - Bound the bytes all thread caches and depots
+ *     together may hold. Caches already over a lowered cap shrink as they
+ *     decay, and depots at the next decay check.
+ */
+void mm_mt_set_cache_cap(size_t bytes)
+{
+    cache_cap = bytes;
+}
+
+/*
+ * mm_mt_deinit - Give all memory back at once. No thread may be using the
+ *     allocator.
+ */
+void mm_mt_deinit(void)
+{
+    int i;
+
+    if ( num_heaps > 0 )
+    {
+        for (i = 0; i <= num_heaps; i++)
+            pthread_mutex_destroy(&heaps[i].lock);
+        for (i = 0; i < NUM_CLASSES; i++)
+            pthread_mutex_destroy(&depots[i].lock);
+    }
+    num_heaps = 0;
+    generation++;               // forget every thread's heap and cache
+
+    mm_heap_destroy(large_heap);
+    mem_region_destroy(large_region);
+    mem_region_destroy(sb_region);
+    large_heap = NULL;
+    large_region = sb_region = NULL;
+}
+
+/*
+ * thread_heap - The calling thread's heap, assigned on first use along
+ *     with an empty magazine cache
+ */
+static inline mt_heap_t *thread_heap(void)
+{
+    if ( my_generation != generation || my_heap == NULL )
+    {
+        unsigned int n = __sync_fetch_and_add(&next_heap, 1);
+        my_heap = &heaps[1 + n % num_heaps];
+        my_generation = generation;
+        memset(&my_cache, 0, sizeof(my_cache));
+        my_tick = my_decay_at = 0;
+        pthread_setspecific(cache_key, &my_cache);
+
+        pthread_mutex_lock(&registry_lock);
+        my_cache.next = registry;
+        if ( registry != NULL )
+            registry->prev = &my_cache;
+        registry = &my_cache;
+        pthread_mutex_unlock(&registry_lock);
+    }
+    return my_heap;
+}
+
+static inline void count_live(long delta)
+{
+    size_t now = __sync_add_and_fetch(&live_bytes, delta);
+    size_t peak;
+
+    while ((peak = __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED)) < now &&
+           !__sync_bool_compare_and_swap(&peak_live_bytes, peak, now))
+        ;
+}
+
+static inline int bucket_of(superblock_t *sb)
+{
+    if ( sb->used == sb->nobjs )
+        return FULL_BUCKET;
+
+    // 0 when empty, otherwise 1-4 by quarters of fullness
+    return (sb->used * 4 + sb->nobjs - 1) / sb->nobjs;
+}
+
+static inline void sb_link(mt_heap_t *h, superblock_t *sb)
+{
+    superblock_t **head = &h->bins[sb->sclass][sb->bucket];
+
+    sb->prev = NULL;
+    sb->next = *head;
+    if ( *head != NULL )
+        (*head)->prev = sb;
+    *head = sb;
+}
+
+static inline void sb_unlink(mt_heap_t *h, superblock_t *sb)
+{
+    if ( sb->prev != NULL )
+        sb->prev->next = sb->next;
+    else
+        h->bins[sb->sclass][sb->bucket] = sb->next;
+    if ( sb->next != NULL )
+        sb->next->prev = sb->prev;
+}
+
+// Move sb to the bucket matching its fullness
+static inline void sb_rebucket(mt_heap_t *h, superblock_t *sb)
+{
+    int b = bucket_of(sb);
+
+    if ( b != sb->bucket )
+    {
+        sb_unlink(h, sb);
+        sb->bucket = b;
+        sb_link(h, sb);
+    }
+}
+
+static void sb_format(superblock_t *sb, int sclass)
+{
+    sb->sclass = sclass;
+    sb->obj_size = class_size[sclass];
+    sb->nobjs = (SB_SIZE - SB_HDR_SIZE) / sb->obj_size;
+    sb->used = 0;
+    sb->bucket = 0;
+    sb->free_list = NULL;
+    sb->carve = (char *)sb + SB_HDR_SIZE;
+}
+
+// Hand sb from one locked heap to another
+static void sb_move(mt_heap_t *from, mt_heap_t *to, superblock_t *sb)
+{
+    size_t bytes = sb->used * sb->obj_size;
+
+    sb_unlink(from, sb);
+    from->held -= SB_SIZE;
+    from->in_use -= bytes;
+
+    __atomic_store_n(&sb->owner, to, __ATOMIC_RELEASE);
+    to->held += SB_SIZE;
+    to->in_use += bytes;
+    sb_link(to, sb);
+}
+
+/*
+ * mm_mt_malloc - Allocate size bytes from the calling thread's cache or heap
+ */
+void *mm_mt_malloc(size_t size)
+{
+    mt_heap_t *h;
+    void *bp;
+    int c;
+
+    if ( size == 0 )
+        return NULL;
+
+    if ( size > SMALL_MAX )
+        return large_malloc(size);
+
+    c = size_to_class[(size + 15) / 16];
+    h = thread_heap();
+
+    if ( magazines_on )
+    {
+        bp = cache_alloc(c);
+    }
+    else
+    {
+        pthread_mutex_lock(&h->lock);
+        bp = heap_alloc(h, c);
+        pthread_mutex_unlock(&h->lock);
+    }
+
+    if ( bp != NULL )
+        count_live(class_size[c]);
+    return bp;
+}
+
+/*
+ * heap_alloc - Take one object of class c from heap h (locked), out of the
+ *     fullest superblock with room
+ */
+static void *heap_alloc(mt_heap_t *h, int c)
+{
+    superblock_t *sb = NULL;
+    void *bp;
+    int b;
+
+    for (b = FULL_BUCKET - 1; b >= 0 && sb == NULL; b--)
+        sb = h->bins[c][b];
+
+    if ( sb == NULL && (sb = get_superblock(h, c)) == NULL )
+        return NULL;
+
+    if ( sb->free_list != NULL )
+    {
+        bp = sb->free_list;
+        sb->free_list = *(void **)bp;
+    }
+    else
+    {
+        bp = sb->carve;
+        sb->carve += sb->obj_size;
+    }
+    sb->used++;
+    h->in_use += sb->obj_size;
+    sb_rebucket(h, sb);
+    return bp;
+}
+
+/*
+ * get_superblock - Find thread heap h (locked) a superblock with room for
+ *     class sclass: one of that class from the global heap, then an empty
+ *     one of any class, and only then a new one from memlib.
+ */
+static superblock_t *get_superblock(mt_heap_t *h, int sclass)
+{
+    mt_heap_t *global = &heaps[0];
+    superblock_t *sb = NULL;
+    int c, b;
+
+    pthread_mutex_lock(&global->lock);
+
+    for (b = FULL_BUCKET - 1; b >= 0 && sb == NULL; b--)
+        sb = global->bins[sclass][b];
+    for (c = 0; c < NUM_CLASSES && sb == NULL; c++)
+        sb = global->bins[c][0];
+
+    if ( sb != NULL )
+    {
+        if ( sb->sclass != sclass )
+        {
+            // empty, so it can take up another class
+            sb_unlink(global, sb);
+            sb_format(sb, sclass);
+            sb_link(global, sb);
+        }
+        sb_move(global, h, sb);
+        pthread_mutex_unlock(&global->lock);
+        __sync_fetch_and_add(&sb_reused, 1);
+        return sb;
+    }
+
+    pthread_mutex_unlock(&global->lock);
+
+    pthread_mutex_lock(&sbrk_lock);
+    sb = mem_region_sbrk(sb_region, SB_SIZE);
+    pthread_mutex_unlock(&sbrk_lock);
+    if ( sb == (void *)-1 )
+        return NULL;
+
+    sb_format(sb, sclass);
+    sb->owner = h;
+    h->held += SB_SIZE;
+    sb_link(h, sb);
+    return sb;
+}
+
+/*
+ * mm_mt_free - Free a block from mm_mt_malloc, from any thread
+ */
+void mm_mt_free(void *bp)
+{
+    int c;
+
+    if ( bp == NULL )
+        return;
+
+    // the brk moves under other threads, but the storage bounds don't
+    if ( (char *)bp < sb_lo || (char *)bp >= sb_end )
+    {
+        large_free(bp);
+        return;
+    }
+
+    // bp is live, so its superblock can't be reformatted under us
+    c = SB_OF(bp)->sclass;
+
+    if ( magazines_on )
+    {
+        thread_heap();              // makes sure the thread's cache is set up
+        cache_free(bp, c);
+    }
+    else
+        heap_free_batch(&bp, 1);
+
+    count_live(-(long)class_size[c]);
+}
+
+/*
+ * lock_owner - Lock the heap owning sb, which may change until it's locked
+ */
+static mt_heap_t *lock_owner(superblock_t *sb)
+{
+    mt_heap_t *h;
+
+    for (;;)
+    {
+        h = __atomic_load_n(&sb->owner, __ATOMIC_ACQUIRE);
+        pthread_mutex_lock(&h->lock);
+        if ( __atomic_load_n(&sb->owner, __ATOMIC_RELAXED) == h )
+            return h;
+        pthread_mutex_unlock(&h->lock);
+    }
+}
+
+/*
+ * heap_free_batch - Put n objects back in their superblocks. Runs of
+ *     objects with the same owner are freed under one lock.
+ */
+static void heap_free_batch(void **objs, int n)
+{
+    mt_heap_t *h = NULL;
+    superblock_t *sb;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        sb = SB_OF(objs[i]);
+        if ( h == NULL || __atomic_load_n(&sb->owner, __ATOMIC_RELAXED) != h )
+        {
+            if ( h != NULL )
+                pthread_mutex_unlock(&h->lock);
+            h = lock_owner(sb);
+        }
+
+        *(void **)objs[i] = sb->free_list;
+        sb->free_list = objs[i];
+        sb->used--;
+        h->in_use -= sb->obj_size;
+        sb_rebucket(h, sb);
+
+        if ( h != &heaps[0] && empty_fraction > 0 &&
+             h->in_use + SLACK_SBS * SB_SIZE < h->held &&
+             h->in_use < (1 - empty_fraction) * h->held )
+            release_superblock(h);
+    }
+
+    if ( h != NULL )
+        pthread_mutex_unlock(&h->lock);
+}
+
+// Most objects of class c one magazine can hold
+static inline int mag_capacity(int c)
+{
+    int capacity = MAG_BYTES / class_size[c];
+
+    if ( capacity < MAG_MIN )
+        return MAG_MIN;
+    if ( capacity > MAG_MAX )
+        return MAG_MAX;
+    return capacity;
+}
+
+/*
+ * mag_new - A new, empty magazine for class c, with room for the largest
+ *     limit any thread may set. Magazines come from the large heap and
+ *     aren't counted as live memory.
+ */
+static magazine_t *mag_new(int c)
+{
+    magazine_t *m;
+    int capacity = mag_capacity(c);
+
+    pthread_mutex_lock(&large_lock);
+    m = mm_heap_malloc(large_heap, sizeof(magazine_t) + capacity * sizeof(void *));
+    pthread_mutex_unlock(&large_lock);
+
+    if ( m != NULL )
+    {
+        m->next = NULL;
+        m->rounds = 0;
+        m->capacity = capacity;
+    }
+    return m;
+}
+
+static void mag_free(magazine_t *m)
+{
+    pthread_mutex_lock(&large_lock);
+    mm_heap_free(large_heap, m);
+    pthread_mutex_unlock(&large_lock);
+}
+
+/*
+ * cache_set_limit - Change the calling thread's magazine limit for class
+ *     c. Each magazine slot reserves room for two objects (loaded and
+ *     previous) against the global cache cap, which the depots' objects
+ *     count against too; growing fails, leaving the limit as it was, if
+ *     the cap would be exceeded. Returns nonzero if the limit changed.
+ */
+static int cache_set_limit(mag_cache_t *mc, int c, int limit)
+{
+    long delta = 2 * (long)(limit - mc->limit) * (long)class_size[c];
+    size_t reserved, max;
+
+    if ( delta > 0 )
+    {
+        do
+        {
+            reserved = __atomic_load_n(&cache_reserved, __ATOMIC_RELAXED);
+            if ( reserved + __atomic_load_n(&depot_bytes, __ATOMIC_RELAXED) +
+                 delta > cache_cap )
+                return 0;
+        } while (!__sync_bool_compare_and_swap(&cache_reserved, reserved,
+                                                reserved + delta));
+    }
+    else
+        __sync_fetch_and_add(&cache_reserved, delta);
+
+    __sync_fetch_and_add(&class_limits[c], (long)(limit - mc->limit));
+    mc->limit = limit;
+    while ((max = __atomic_load_n(&class_max_limit[c], __ATOMIC_RELAXED)) < (size_t)limit &&
+           !__sync_bool_compare_and_swap(&class_max_limit[c], max, limit))
+        ;
+    return 1;
+}
+
+/*
+ * cache_tick - Bookkeeping at every cached operation on class c: counts
+ *     the thread's clock, starts the class at the smallest limit on first
+ *     use, and runs the decay check once a window. Returns zero if the
+ *     class has no cache because the global cap is used up.
+ */
+static inline int cache_tick(mag_cache_t *mc, int c)
+{
+    mc->last_use = ++my_tick;
+    __atomic_store_n(&my_cache.last_epoch,
+                     __atomic_load_n(&decay_epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+
+    if ( my_tick - my_decay_at >= DECAY_WINDOW )
+        cache_decay();
+
+    if ( mc->limit == 0 )
+        cache_set_limit(mc, c, MAG_MIN);
+    return mc->limit;
+}
+
+/*
+ * cache_miss - The thread had to go past its magazines for class c. A
+ *     class that misses GROW_MISSES times in one window gets its limit
+ *     doubled, up to what a magazine holds.
+ */
+static void cache_miss(mag_cache_t *mc, int c)
+{
+    int limit = mc->limit * 2;
+
+    __sync_fetch_and_add(&class_misses[c], 1);
+    if ( ++mc->misses < GROW_MISSES )
+        return;
+
+    mc->misses = 0;
+    if ( limit > mag_capacity(c) )
+        limit = mag_capacity(c);
+    if ( limit > mc->limit )
+        cache_set_limit(mc, c, limit);
+}
+
+// Give back objects from m beyond keep
+static inline void mag_trim(magazine_t *m, int keep)
+{
+    if ( m != NULL && m->rounds > keep )
+    {
+        heap_free_batch(m->objs + keep, m->rounds - keep);
+        m->rounds = keep;
+    }
+}
+
+/*
+ * cache_decay - Once every DECAY_WINDOW operations of a thread, halve the
+ *     limit of each class it hasn't touched for a whole window and give
+ *     back the objects over the new limit. A class shrunk below MAG_MIN
+ *     gives back everything, magazines included. Idle threads' caches and
+ *     depots over the cap are emptied too.
+ */
+static void cache_decay(void)
+{
+    mag_cache_t *mc;
+    int c, limit;
+
+    my_decay_at = my_tick;
+    cache_reclaim_idle(__sync_add_and_fetch(&decay_epoch, 1));
+    depot_trim();
+
+    for (c = 0; c < NUM_CLASSES; c++)
+    {
+        mc = &my_cache.classes[c];
+        mc->misses = 0;
+        if ( mc->limit == 0 || my_tick - mc->last_use < DECAY_WINDOW )
+            continue;
+
+        __sync_fetch_and_add(&class_trims[c], 1);
+        limit = mc->limit / 2;
+        if ( limit < MAG_MIN )
+        {
+            cache_flush(mc, c);
+            continue;
+        }
+
+        // previous stays full (at the new limit) or empty
+        mag_trim(mc->loaded, limit);
+        mag_trim(mc->previous, limit);
+        cache_set_limit(mc, c, limit);
+    }
+}
+
+/*
+ * cache_reclaim_idle - Empty the caches of threads that haven't made a
+ *     cached operation for IDLE_EPOCHS decay checks, as of decay check
+ *     epoch. A cache whose thread is in the middle of an operation is
+ *     left for the next check.
+ */
+static void cache_reclaim_idle(unsigned int epoch)
+{
+    thread_cache_t *tc;
+    mag_cache_t *mc;
+    int c;
+
+    pthread_mutex_lock(&registry_lock);
+    for (tc = registry; tc != NULL; tc = tc->next)
+    {
+        if ( tc == &my_cache ||
+             epoch - __atomic_load_n(&tc->last_epoch, __ATOMIC_RELAXED) < IDLE_EPOCHS ||
+             __atomic_exchange_n(&tc->lock, 1, __ATOMIC_ACQUIRE) != 0 )
+            continue;
+
+        for (c = 0; c < NUM_CLASSES; c++)
+        {
+            mc = &tc->classes[c];
+            if ( mc->limit == 0 && mc->loaded == NULL && mc->previous == NULL )
+                continue;
+            __sync_fetch_and_add(&class_trims[c], 1);
+            cache_flush(mc, c);
+        }
+        __atomic_store_n(&tc->lock, 0, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/*
+ * depot_trim - While the caches and depots hold more than the cap allows
+ *     (the cap was lowered), empty full depot magazines back into the heaps
+ */
+static void depot_trim(void)
+{
+    magazine_t *m;
+    int c;
+
+    for (c = 0; c < NUM_CLASSES; c++)
+    {
+        while (__atomic_load_n(&cache_reserved, __ATOMIC_RELAXED) +
+               __atomic_load_n(&depot_bytes, __ATOMIC_RELAXED) > cache_cap)
+        {
+            pthread_mutex_lock(&depots[c].lock);
+            if ( (m = depots[c].full) != NULL )
+            {
+                depots[c].full = m->next;
+                depots[c].nfull--;
+                __sync_fetch_and_sub(&depot_bytes, m->rounds * class_size[c]);
+            }
+            pthread_mutex_unlock(&depots[c].lock);
+            if ( m == NULL )
+                break;
+
+            heap_free_batch(m->objs, m->rounds);
+            mag_free(m);
+            __sync_fetch_and_add(&mag_flushes, 1);
+        }
+    }
+}
+
+/*
+ * depot_charge - Count bytes more in the depots against the cap. Returns
+ *     zero, charging nothing, if they don't fit.
+ */
+static int depot_charge(size_t bytes)
+{
+    size_t held;
+
+    do
+    {
+        held = __atomic_load_n(&depot_bytes, __ATOMIC_RELAXED);
+        if ( __atomic_load_n(&cache_reserved, __ATOMIC_RELAXED) + held +
+             bytes > cache_cap )
+            return 0;
+    } while (!__sync_bool_compare_and_swap(&depot_bytes, held, held + bytes));
+    return 1;
+}
+
+/*
+ * cache_lock - Take the calling thread's cache lock word. Only a thread
+ *     emptying an idle cache competes for it, and only briefly.
+ */
+static inline void cache_lock(void)
+{
+    while (__atomic_exchange_n(&my_cache.lock, 1, __ATOMIC_ACQUIRE) != 0)
+        sched_yield();
+}
+
+static inline void cache_unlock(void)
+{
+    __atomic_store_n(&my_cache.lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * cache_alloc - Allocate an object of class c from the calling thread's
+ *     magazines. When both are empty, the previous one is traded for a
+ *     full magazine from the depot, and if the depot has none the loaded
+ *     one is filled from the thread heap under a single lock. A full
+ *     magazine from the depot may hold more than this thread's limit,
+ *     and the excess goes back to the heaps.
+ */
+static void *cache_alloc_locked(int c)
+{
+    mag_cache_t *mc = &my_cache.classes[c];
+    depot_t *d = &depots[c];
+    magazine_t *m, *spare = NULL;
+    void *bp;
+
+    if ( !cache_tick(mc, c) )
+    {
+        // the cap is used up; go straight to the heap
+        pthread_mutex_lock(&my_heap->lock);
+        bp = heap_alloc(my_heap, c);
+        pthread_mutex_unlock(&my_heap->lock);
+        return bp;
+    }
+
+    if ( mc->loaded != NULL && mc->loaded->rounds > 0 )
+        return mc->loaded->objs[--mc->loaded->rounds];
+
+    if ( mc->previous != NULL && mc->previous->rounds > 0 )
+    {
+        m = mc->previous;
+        mc->previous = mc->loaded;
+        mc->loaded = m;
+        return m->objs[--m->rounds];
+    }
+
+    cache_miss(mc, c);
+
+    pthread_mutex_lock(&d->lock);
+    if ( (m = d->full) != NULL )
+    {
+        d->full = m->next;
+        d->nfull--;
+        __sync_fetch_and_sub(&depot_bytes, m->rounds * class_size[c]);
+        if ( mc->previous != NULL )
+        {
+            if ( d->nempty < DEPOT_MAX_EMPTY )
+            {
+                mc->previous->next = d->empty;
+                d->empty = mc->previous;
+                d->nempty++;
+            }
+            else
+                spare = mc->previous;
+        }
+        mc->previous = mc->loaded;
+        mc->loaded = m;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    if ( spare != NULL )
+        mag_free(spare);
+
+    if ( m != NULL )
+    {
+        mag_trim(m, mc->limit);
+        __sync_fetch_and_add(&mag_swaps, 1);
+        return m->objs[--m->rounds];
+    }
+
+    // The depot is dry
+    if ( mc->loaded == NULL && (mc->loaded = mag_new(c)) == NULL )
+        return NULL;
+
+    m = mc->loaded;
+    pthread_mutex_lock(&my_heap->lock);
+    while (m->rounds < mc->limit &&
+           (m->objs[m->rounds] = heap_alloc(my_heap, c)) != NULL)
+        m->rounds++;
+    pthread_mutex_unlock(&my_heap->lock);
+
+    if ( m->rounds == 0 )
+        return NULL;
+
+    __sync_fetch_and_add(&mag_fills, 1);
+    return m->objs[--m->rounds];
+}
+
+/*
+ * cache_free - Put an object of class c in the calling thread's
+ *     magazines. When both are full, the previous one goes to the depot
+ *     in exchange for an empty one; if the depot is holding as many full
+ *     magazines as it may, or its objects would take the caches over the
+ *     cap, that one is emptied back into the heaps instead.
+ */
+static void cache_free_locked(void *bp, int c)
+{
+    mag_cache_t *mc = &my_cache.classes[c];
+    depot_t *d = &depots[c];
+    magazine_t *m, *flush = NULL;
+
+    if ( !cache_tick(mc, c) )
+    {
+        heap_free_batch(&bp, 1);
+        return;
+    }
+
+    if ( mc->loaded != NULL && mc->loaded->rounds < mc->limit )
+    {
+        mc->loaded->objs[mc->loaded->rounds++] = bp;
+        return;
+    }
+
+    if ( mc->previous != NULL && mc->previous->rounds == 0 )
+    {
+        m = mc->previous;
+        mc->previous = mc->loaded;
+        mc->loaded = m;
+        m->objs[m->rounds++] = bp;
+        return;
+    }
+
+    cache_miss(mc, c);
+
+    pthread_mutex_lock(&d->lock);
+    if ( mc->previous != NULL )
+    {
+        if ( d->nfull < DEPOT_MAX_FULL &&
+             depot_charge(mc->previous->rounds * class_size[c]) )
+        {
+            mc->previous->next = d->full;
+            d->full = mc->previous;
+            d->nfull++;
+        }
+        else
+            flush = mc->previous;
+    }
+    mc->previous = mc->loaded;
+    if ( (m = d->empty) != NULL )
+    {
+        d->empty = m->next;
+        d->nempty--;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    if ( flush != NULL )
+    {
+        heap_free_batch(flush->objs, flush->rounds);
+        flush->rounds = 0;
+        __sync_fetch_and_add(&mag_flushes, 1);
+        if ( m == NULL )
+            m = flush;
+        else
+            mag_free(flush);
+    }
+    else
+        __sync_fetch_and_add(&mag_swaps, 1);
+
+    if ( m == NULL && (m = mag_new(c)) == NULL )
+    {
+        // no room even for a magazine; skip the cache
+        heap_free_batch(&bp, 1);
+        return;
+    }
+
+    mc->loaded = m;
+    m->objs[m->rounds++] = bp;
+}
+
+static void *cache_alloc(int c)
+{
+    void *bp;
+
+    cache_lock();
+    bp = cache_alloc_locked(c);
+    cache_unlock();
+    return bp;
+}
+
+static void cache_free(void *bp, int c)
+{
+    cache_lock();
+    cache_free_locked(bp, c);
+    cache_unlock();
+}
+
+/*
+ * cache_destroy - Thread exit: take the thread's cache out of the
+ *     registry, give its cached objects back to the heaps and drop its
+ *     magazines
+ */
+static void cache_destroy(void *arg)
+{
+    int c;
+
+    if ( my_generation != generation )
+        return;
+
+    // with the registry locked, no other thread holds our cache
+    pthread_mutex_lock(&registry_lock);
+    if ( my_cache.prev != NULL )
+        my_cache.prev->next = my_cache.next;
+    else
+        registry = my_cache.next;
+    if ( my_cache.next != NULL )
+        my_cache.next->prev = my_cache.prev;
+    for (c = 0; c < NUM_CLASSES; c++)
+        cache_flush(&my_cache.classes[c], c);
+    pthread_mutex_unlock(&registry_lock);
+    my_heap = NULL;
+}
+
+/*
+ * cache_flush - Empty and free both of a class's magazines and release
+ *     its reservation against the cap
+ */
+static void cache_flush(mag_cache_t *mc, int c)
+{
+    magazine_t *m[2] = { mc->loaded, mc->previous };
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        if ( m[i] == NULL )
+            continue;
+        heap_free_batch(m[i]->objs, m[i]->rounds);
+        mag_free(m[i]);
+    }
+    mc->loaded = mc->previous = NULL;
+    if ( mc->limit != 0 )
+        cache_set_limit(mc, c, 0);
+}
+
+/*
+ * release_superblock - Move thread heap h's (locked) emptiest superblock
+ *     to the global heap
+ */
+static void release_superblock(mt_heap_t *h)
+{
+    mt_heap_t *global = &heaps[0];
+    superblock_t *sb = NULL;
+    int c, b;
+
+    for (b = 0; b < FULL_BUCKET && sb == NULL; b++)
+        for (c = 0; c < NUM_CLASSES && sb == NULL; c++)
+            sb = h->bins[c][b];
+    if ( sb == NULL )
+        return;
+
+    pthread_mutex_lock(&global->lock);
+    sb_move(h, global, sb);
+    pthread_mutex_unlock(&global->lock);
+    __sync_fetch_and_add(&sb_released, 1);
+}
+
+static void *large_malloc(size_t size)
+{
+    void *bp;
+
+    pthread_mutex_lock(&large_lock);
+    bp = mm_heap_malloc(large_heap, size);
+    pthread_mutex_unlock(&large_lock);
+
+    if ( bp != NULL )
+        count_live(mm_usable_size(bp));
+    return bp;
+}
+
+static void large_free(void *bp)
+{
+    size_t size = mm_usable_size(bp);
+
+    pthread_mutex_lock(&large_lock);
+    mm_heap_free(large_heap, bp);
+    pthread_mutex_unlock(&large_lock);
+
+    count_live(-(long)size);
+}
+
+/*
+ * mm_mt_stats - Snapshot of the allocator's counters
+ */
+void mm_mt_stats(mm_mt_stats_t *stats)
+{
+    stats->live = live_bytes;
+    stats->peak_live = peak_live_bytes;
+    stats->footprint = mem_region_heapsize(sb_region) +
+                       mem_region_heapsize(large_region);
+    stats->sb_released = sb_released;
+    stats->sb_reused = sb_reused;
+    stats->mag_fills = mag_fills;
+    stats->mag_swaps = mag_swaps;
+    stats->mag_flushes = mag_flushes;
+    stats->cache_bytes = cache_reserved + depot_bytes;
+    stats->cache_cap = cache_cap;
+}
+
+int mm_mt_num_classes(void)
+{
+    return NUM_CLASSES;
+}
+
+/*
+ * mm_mt_class_stats - Counters and current magazine limits for size class
+ *     sclass (0 to mm_mt_num_classes() - 1)
+ */
+void mm_mt_class_stats(int sclass, mm_mt_class_stats_t *stats)
+{
+    stats->size = class_size[sclass];
+    stats->limit = class_limits[sclass];
+    stats->max_limit = class_max_limit[sclass];
+    stats->capacity = mag_capacity(sclass);
+    stats->misses = class_misses[sclass];
+    stats->trims = class_trims[sclass];
+}
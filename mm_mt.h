@@ -0,0 +1,53 @@
+/*
+ * mm_mt.h - Thread-safe allocator with per-thread heaps (Hoard-style)
+ *
+ * Small requests are served from superblocks: fixed-size chunks of one
+ * memlib region, each holding objects of a single size class. Every
+ * thread allocates from its own heap, and a block is always freed back
+ * into the superblock it came from, whichever thread frees it. When a
+ * thread heap's superblocks are mostly empty, the emptiest ones move to a
+ * global heap where any thread can pick them up, so memory held is bounded
+ * by a constant factor of memory in use. Large requests go to an mm heap
+ * of their own under a lock.
+ */
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    size_t live;          /* bytes handed out and not yet freed */
+    size_t peak_live;     /* most bytes ever live at once */
+    size_t footprint;     /* bytes taken from memlib, which never shrinks */
+    size_t sb_released;   /* superblocks moved from thread heaps to global */
+    size_t sb_reused;     /* superblocks thread heaps took from global */
+    size_t mag_fills;     /* magazines filled from a thread heap */
+    size_t mag_swaps;     /* magazines traded with a depot */
+    size_t mag_flushes;   /* full magazines emptied back into the heaps */
+    size_t cache_bytes;   /* bytes reserved by thread caches or in depots */
+    size_t cache_cap;     /* most bytes caches and depots may hold */
+} mm_mt_stats_t;
+
+typedef struct {
+    size_t size;          /* object size of the class */
+    size_t limit;         /* magazine limits summed over running threads */
+    size_t max_limit;     /* largest limit any thread has had */
+    size_t capacity;      /* largest limit a thread may have */
+    size_t misses;        /* trips past a thread's magazines */
+    size_t trims;         /* idle thread caches shrunk or emptied */
+} mm_mt_class_stats_t;
+
+extern int mm_mt_init(int nheaps, double fraction);
+extern void mm_mt_deinit(void);
+extern void mm_mt_set_magazines(int on);
+extern void *mm_mt_malloc(size_t size);
+extern void mm_mt_free(void *ptr);
+extern void mm_mt_stats(mm_mt_stats_t *stats);
+extern void mm_mt_set_cache_cap(size_t bytes);
+extern int mm_mt_num_classes(void);
+extern void mm_mt_class_stats(int sclass, mm_mt_class_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,175 @@
+/*
+ * mm_new.cc - Replacement global operator new and delete on top of mm
+ *
+ * Linking this file into a program (along with mm.o and memlib.o) sends
+ * every global new and delete, including the sized and aligned forms, to
+ * mm. Library code may allocate from any thread, so these hold
+ * mm_cxx_lock() while in mm.
+ */
+#include "mm_cxx.h"
+
+/*
+ * mm_new - Common allocation path, following the operator new contract:
+ *     retry through the installed new_handler, and throw if there is none.
+ */
+static void *mm_new(std::size_t size, std::size_t align)
+{
+    void *p;
+
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> guard(mm_cxx_lock());
+            if (mm_cxx_init() && (p = mm_cxx_alloc(size, align)) != NULL)
+                return p;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+        if (handler == NULL)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+static void *mm_new_nothrow(std::size_t size, std::size_t align) noexcept
+{
+    try {
+        return mm_new(size, align);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+/*
+ * default_align - Alignment plain new owes an object of size bytes. A
+ *     type's alignment divides its size, so the object needs no more than
+ *     the largest power of two dividing size, capped at the default new
+ *     alignment. Sizes that need no more than mm_malloc's own alignment
+ *     skip mm_memalign and its slack.
+ */
+static inline std::size_t default_align(std::size_t size)
+{
+    std::size_t align = size & (~size + 1);   // lowest set bit
+
+    if (align <= mm_alignment)
+        return mm_alignment;
+    return (align < __STDCPP_DEFAULT_NEW_ALIGNMENT__) ?
+        align : __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+}
+
+static void mm_delete(void *p, std::size_t size)
+{
+    if (p == NULL)
+        return;
+    std::lock_guard<std::mutex> guard(mm_cxx_lock());
+    if (size != 0)
+        mm_free_sized(p, size);
+    else
+        mm_free(p);
+}
+
+/* Plain forms */
+void *operator new(std::size_t size)
+{
+    return mm_new(size, default_align(size));
+}
+
+void *operator new[](std::size_t size)
+{
+    return mm_new(size, default_align(size));
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return mm_new_nothrow(size, default_align(size));
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return mm_new_nothrow(size, default_align(size));
+}
+
+void operator delete(void *p) noexcept
+{
+    mm_delete(p, 0);
+}
+
+void operator delete[](void *p) noexcept
+{
+    mm_delete(p, 0);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    mm_delete(p, 0);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    mm_delete(p, 0);
+}
+
+/* Sized forms */
+void operator delete(void *p, std::size_t size) noexcept
+{
+    mm_delete(p, size);
+}
+
+void operator delete[](void *p, std::size_t size) noexcept
+{
+    mm_delete(p, size);
+}
+
+/* Aligned forms */
+void *operator new(std::size_t size, std::align_val_t align)
+{
+    return mm_new(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align)
+{
+    return mm_new(size, static_cast<std::size_t>(align));
+}
+
+void *operator new(std::size_t size, std::align_val_t align,
+                   const std::nothrow_t &) noexcept
+{
+    return mm_new_nothrow(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align,
+                     const std::nothrow_t &) noexcept
+{
+    return mm_new_nothrow(size, static_cast<std::size_t>(align));
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    mm_delete(p, 0);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    mm_delete(p, 0);
+}
+
+void operator delete(void *p, std::align_val_t,
+                     const std::nothrow_t &) noexcept
+{
+    mm_delete(p, 0);
+}
+
+void operator delete[](void *p, std::align_val_t,
+                       const std::nothrow_t &) noexcept
+{
+    mm_delete(p, 0);
+}
+
+void operator delete(void *p, std::size_t size, std::align_val_t) noexcept
+{
+    mm_delete(p, size);
+}
+
+void operator delete[](void *p, std::size_t size, std::align_val_t) noexcept
+{
+    mm_delete(p, size);
+}
@@ -0,0 +1,169 @@
+/*
+ * mm_pool.h - Typed object pools carved from mm slabs
+ *
+ * mm::object_pool<T, BlockObjs> gets slabs of BlockObjs slots from mm and
+ * hands out single T's. A free slot holds the link to the next free slot,
+ * so the pool needs no memory of its own beyond the slabs, and create and
+ * destroy are a few instructions each except when a slab runs out.
+ *
+ * Every object must be destroyed through the pool that created it, and
+ * before that pool goes away; the pool's destructor returns whole slabs
+ * to mm without running any destructors. A pool itself is not locked.
+ * object_pool::local() gives each thread a pool of its own, and slab
+ * refills from any pool take the C++ layer's lock around mm.
+ */
+#ifndef __MM_POOL_H_
+#define __MM_POOL_H_
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#include "mm_cxx.h"
+
+namespace mm {
+
+template <class T, std::size_t BlockObjs = 64>
+class object_pool {
+    static_assert(BlockObjs > 0, "a slab must hold at least one object");
+
+    /* A free slot; the T lives in the same bytes once the slot is used */
+    struct free_slot {
+        free_slot *next;
+    };
+
+    /* Start of every slab, linking the pool's slabs together */
+    struct slab_header {
+        slab_header *next;
+    };
+
+    static constexpr std::size_t max_of(std::size_t a, std::size_t b)
+    {
+        return a > b ? a : b;
+    }
+
+    static constexpr std::size_t round_up(std::size_t n, std::size_t align)
+    {
+        return (n + align - 1) / align * align;
+    }
+
+public:
+    /* Slab geometry, fixed at compile time by T's size and alignment */
+    static constexpr std::size_t slot_align =
+        max_of(alignof(T), alignof(free_slot));
+    static constexpr std::size_t slot_size =
+        round_up(max_of(sizeof(T), sizeof(free_slot)), slot_align);
+    static constexpr std::size_t header_size =
+        round_up(sizeof(slab_header), slot_align);
+    static constexpr std::size_t slab_size =
+        header_size + BlockObjs * slot_size;
+    static constexpr std::size_t slab_align = max_of(slot_align, mm_alignment);
+
+    object_pool() noexcept
+        : free_list(NULL), carve(NULL), carve_end(NULL), slabs(NULL),
+          num_slabs(0)
+    {
+    }
+
+    object_pool(const object_pool &) = delete;
+    object_pool &operator=(const object_pool &) = delete;
+
+    ~object_pool()
+    {
+        std::lock_guard<std::mutex> guard(mm_cxx_lock());
+        while (slabs != NULL) {
+            slab_header *next = slabs->next;
+            mm_free_sized(slabs, slab_size);
+            slabs = next;
+        }
+    }
+
+    /* The calling thread's own pool */
+    static object_pool &local()
+    {
+        thread_local object_pool pool;
+        return pool;
+    }
+
+    /* Raw slot for one T, or throws std::bad_alloc */
+    void *allocate()
+    {
+        if (free_list != NULL) {
+            free_slot *slot = free_list;
+            free_list = slot->next;
+            return slot;
+        }
+        if (carve == carve_end)
+            refill();
+        void *p = carve;
+        carve += slot_size;
+        return p;
+    }
+
+    /* Give a slot from allocate() back to the pool */
+    void deallocate(void *p) noexcept
+    {
+        free_slot *slot = static_cast<free_slot *>(p);
+        slot->next = free_list;
+        free_list = slot;
+    }
+
+    /* Construct a T in a pool slot */
+    template <class... Args>
+    T *create(Args &&... args)
+    {
+        void *p = allocate();
+        try {
+            return ::new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(p);
+            throw;
+        }
+    }
+
+    /* Destroy a T made by create() and recycle its slot */
+    void destroy(T *obj) noexcept
+    {
+        if (obj == NULL)
+            return;
+        obj->~T();
+        deallocate(obj);
+    }
+
+    /* Number of slabs this pool holds from mm */
+    std::size_t slab_count() const noexcept { return num_slabs; }
+
+private:
+    /*
+     * refill - Get a fresh slab from mm. Its slots are carved off one at
+     *     a time as needed, so the slab is never written end to end.
+     */
+    void refill()
+    {
+        void *mem;
+        {
+            std::lock_guard<std::mutex> guard(mm_cxx_lock());
+            mem = mm_cxx_init() ? mm_cxx_alloc(slab_size, slab_align) : NULL;
+        }
+        if (mem == NULL)
+            throw std::bad_alloc();
+
+        slab_header *slab = static_cast<slab_header *>(mem);
+        slab->next = slabs;
+        slabs = slab;
+        num_slabs++;
+        carve = static_cast<char *>(mem) + header_size;
+        carve_end = carve + BlockObjs * slot_size;
+    }
+
+    free_slot *free_list;   /* recycled slots, most recent first */
+    char *carve;            /* next never-used slot in the newest slab */
+    char *carve_end;        /* end of the newest slab */
+    slab_header *slabs;     /* every slab, newest first */
+    std::size_t num_slabs;
+};
+
+} /* namespace mm */
+
+#endif /* __MM_POOL_H_ */
@@ -0,0 +1,286 @@
+/*
+ * mtbench.c - Multithreaded workloads on mm_mt, reporting time and memory
+ *             blowup
+ *
+ * Blowup is the memory taken from memlib over the most memory ever live
+ * at once. Each workload runs twice: with thread heaps releasing mostly
+ * empty superblocks to the global heap, and with release turned off.
+ * Trips past a thread's own magazines (fills from its heap plus trades
+ * with the depot) are counted as refills; -m turns magazines off, and
+ * -c caps the memory thread caches may hold. -v prints the magazine
+ * limits each size class reached after every run.
+ *
+ *   threadtest  every thread allocates and frees on its own
+ *   prodcons    threads in pairs; one allocates batches, the other frees
+ *               them
+ *   phased      threads take turns building up a large set and freeing
+ *               it, so only one thread's set is live at a time
+ *
+ * usage: mtbench [-t <threads>] [-n <objects>] [-r <rounds>] [-f <fraction>]
+ *                [-m] [-c <cache KB>] [-v]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mm_mt.h"
+
+#define MAX_THREADS 64
+
+static int num_threads = 4;
+static int num_objs = 10000;
+static int num_rounds = 5;
+static int verbose = 0;
+
+/* State shared by the threads of one run */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int turn;                        /* phased: whose turn it is */
+static void **batches[MAX_THREADS];     /* prodcons: batch waiting per pair */
+static int out_of_memory;               /* some request failed */
+
+typedef struct {
+    int id;
+    unsigned int seed;
+} worker_t;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Mostly small objects, with the odd one big enough to skip superblocks */
+static size_t random_size(unsigned int *seed)
+{
+    unsigned int r = rand_r(seed);
+
+    return (r % 100 == 0) ? 5000 + r % 3000 : 8 + r % 505;
+}
+
+/*
+ * alloc_batch - Allocate n objects, stopping at the first that fails;
+ *     the rest of the batch is left NULL
+ */
+static void **alloc_batch(int n, unsigned int *seed)
+{
+    void **objs = calloc(n, sizeof(void *));
+    int i;
+
+    if (objs == NULL) {
+        fprintf(stderr, "mtbench: malloc failed\n");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        if ((objs[i] = mm_mt_malloc(random_size(seed))) == NULL) {
+            out_of_memory = 1;
+            break;
+        }
+        *(int *)objs[i] = i;
+    }
+    return objs;
+}
+
+static void free_batch(void **objs, int n)
+{
+    int i;
+
+    for (i = 0; i < n && objs[i] != NULL; i++)
+        mm_mt_free(objs[i]);
+    free(objs);
+}
+
+static void *threadtest(void *arg)
+{
+    worker_t *w = arg;
+    int r;
+
+    for (r = 0; r < num_rounds; r++)
+        free_batch(alloc_batch(num_objs / num_threads, &w->seed),
+                   num_objs / num_threads);
+    return NULL;
+}
+
+/* Even ids produce for the next odd id; a lone last thread plays both */
+static void *prodcons(void *arg)
+{
+    worker_t *w = arg;
+    int pair = w->id / 2;
+    int batch = num_objs / 10;
+    int i;
+    void **objs;
+
+    if (w->id % 2 == 0 && w->id == num_threads - 1)
+        return threadtest(arg);
+
+    for (i = 0; i < num_rounds * 10; i++) {
+        if (w->id % 2 == 0) {
+            objs = alloc_batch(batch, &w->seed);
+            pthread_mutex_lock(&lock);
+            while (batches[pair] != NULL)
+                pthread_cond_wait(&cond, &lock);
+            batches[pair] = objs;
+            pthread_cond_broadcast(&cond);
+            pthread_mutex_unlock(&lock);
+        } else {
+            pthread_mutex_lock(&lock);
+            while (batches[pair] == NULL)
+                pthread_cond_wait(&cond, &lock);
+            objs = batches[pair];
+            batches[pair] = NULL;
+            pthread_cond_broadcast(&cond);
+            pthread_mutex_unlock(&lock);
+            free_batch(objs, batch);
+        }
+    }
+    return NULL;
+}
+
+static void *phased(void *arg)
+{
+    worker_t *w = arg;
+    int r;
+
+    for (r = 0; r < num_rounds; r++) {
+        pthread_mutex_lock(&lock);
+        while (turn % num_threads != w->id)
+            pthread_cond_wait(&cond, &lock);
+        pthread_mutex_unlock(&lock);
+
+        free_batch(alloc_batch(num_objs, &w->seed), num_objs);
+
+        pthread_mutex_lock(&lock);
+        turn++;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+/*
+ * print_classes - Magazine limits and misses per size class
+ */
+static void print_classes(void)
+{
+    mm_mt_class_stats_t cs;
+    int c;
+
+    printf("    %8s%10s%10s%10s%10s\n", "size", "max limit", "capacity",
+           "misses", "trims");
+    for (c = 0; c < mm_mt_num_classes(); c++) {
+        mm_mt_class_stats(c, &cs);
+        if (cs.misses == 0 && cs.max_limit == 0)
+            continue;
+        printf("    %8lu%10lu%10lu%10lu%10lu\n", (unsigned long)cs.size,
+               (unsigned long)cs.max_limit, (unsigned long)cs.capacity,
+               (unsigned long)cs.misses, (unsigned long)cs.trims);
+    }
+}
+
+/*
+ * run - Time one workload on a fresh allocator and print a result line
+ */
+static void run(const char *name, void *(*fn)(void *), double fraction)
+{
+    pthread_t tids[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+    mm_mt_stats_t st;
+    double start, secs;
+    int i;
+
+    if (mm_mt_init(num_threads, fraction) < 0) {
+        fprintf(stderr, "mtbench: mm_mt_init failed\n");
+        exit(1);
+    }
+    turn = 0;
+    out_of_memory = 0;
+    for (i = 0; i < MAX_THREADS; i++)
+        batches[i] = NULL;
+
+    start = now_secs();
+    for (i = 0; i < num_threads; i++) {
+        workers[i].id = i;
+        workers[i].seed = i + 1;
+        if (pthread_create(&tids[i], NULL, fn, &workers[i]) != 0) {
+            fprintf(stderr, "mtbench: pthread_create failed\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < num_threads; i++)
+        pthread_join(tids[i], NULL);
+    secs = now_secs() - start;
+
+    mm_mt_stats(&st);
+    if (out_of_memory) {
+        printf("%-12s%6.2f%10.1f   out of memory after %.0f KB\n", name,
+               fraction, secs * 1e3, st.footprint / 1024.0);
+        return;
+    }
+    printf("%-12s%6.2f%10.1f%10.0f%10.0f%9.2f%10lu%10lu\n", name, fraction,
+           secs * 1e3, st.peak_live / 1024.0, st.footprint / 1024.0,
+           (double)st.footprint / st.peak_live, (unsigned long)st.sb_released,
+           (unsigned long)(st.mag_fills + st.mag_swaps));
+    if (verbose)
+        print_classes();
+}
+
+int main(int argc, char **argv)
+{
+    double fraction = 0.25;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:n:r:f:mc:v")) != EOF) {
+        switch (c) {
+        case 't':
+            num_threads = atoi(optarg);
+            break;
+        case 'n':
+            num_objs = atoi(optarg);
+            break;
+        case 'r':
+            num_rounds = atoi(optarg);
+            break;
+        case 'f':
+            fraction = atof(optarg);
+            break;
+        case 'm':
+            mm_mt_set_magazines(0);
+            break;
+        case 'c':
+            mm_mt_set_cache_cap((size_t)atoi(optarg) * 1024);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: mtbench [-t <threads>] [-n <objects>] "
+                    "[-r <rounds>] [-f <fraction>] [-m] [-c <cache KB>] "
+                    "[-v]\n");
+            exit(1);
+        }
+    }
+    if (num_threads < 1 || num_threads > MAX_THREADS || num_objs < 10) {
+        fprintf(stderr, "mtbench: need 1-%d threads and at least 10 objects\n",
+                MAX_THREADS);
+        exit(1);
+    }
+
+    printf("%d threads, %d objects, %d rounds\n", num_threads, num_objs,
+           num_rounds);
+    printf("%-12s%6s%10s%10s%10s%9s%10s%10s\n", "workload", "f", "ms",
+           "peak KB", "heap KB", "blowup", "released", "refills");
+
+    run("threadtest", threadtest, fraction);
+    run("threadtest", threadtest, 0);
+    run("prodcons", prodcons, fraction);
+    run("prodcons", prodcons, 0);
+    run("phased", phased, fraction);
+    run("phased", phased, 0);
+
+    mm_mt_deinit();
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * rep2c.c - Compile a tracefile into C: straight-line mm_malloc,
+ *           mm_realloc and mm_free calls with constant arguments.
+ *
+ * usage: rep2c <in.rep|in.repz> <out.c>
+ *
+ * The requests are split into functions of CHUNK_OPS calls each, so the
+ * compiler never sees one enormous function. The generated file defines
+ *
+ *   const char *mm_compiled_trace;  the name of the input tracefile
+ *   const int mm_compiled_ops;      the number of requests
+ *   int mm_compiled_replay(void);   replay them all; -1 if one fails
+ *
+ * and "make compiled TRACE=<file>" links it into mdriver-compiled, where
+ * "-c" times it against the driver's own replay of the same trace.
+ * Timestamps, if the trace has them, are ignored.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tracez.h"
+
+#define MAXLINE   1024
+#define CHUNK_OPS 1000  /* requests per generated function */
+
+static void unix_error(char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+/*
+ * read_op - Read the next request of a text tracefile. Returns 0 at EOF.
+ */
+static int read_op(FILE *fp, tz_op_t *op)
+{
+    char line[MAXLINE];
+    char type[MAXLINE];
+
+    do {
+	if (fgets(line, MAXLINE, fp) == NULL)
+	    return 0;
+    } while (sscanf(line, "%s", type) != 1);
+
+    op->type = type[0];
+    op->size = 0;
+    switch (type[0]) {
+    case TZ_ALLOC:
+    case TZ_REALLOC:
+	if (sscanf(line, "%*s %u %u", &op->index, &op->size) != 2)
+	    app_error("rep2c: malformed request");
+	return 1;
+    case TZ_FREE:
+	if (sscanf(line, "%*s %u", &op->index) != 1)
+	    app_error("rep2c: malformed request");
+	return 1;
+    default:
+	fprintf(stderr, "rep2c: bogus type character (%c)\n", type[0]);
+	exit(1);
+    }
+}
+
+/*
+ * emit_op - Write the call for one request; a new function starts every
+ *     CHUNK_OPS requests
+ */
+static void emit_op(FILE *out, const tz_op_t *op, int num_ids, int *count)
+{
+    if (op->index >= (unsigned)num_ids)
+	app_error("rep2c: block id out of range");
+    if (*count % CHUNK_OPS == 0) {
+	if (*count > 0)
+	    fprintf(out, "    return 0;\n}\n\n");
+	fprintf(out, "static int __attribute__((noinline)) part%d(void)\n{\n",
+		*count / CHUNK_OPS);
+    }
+    switch (op->type) {
+    case TZ_ALLOC:
+	fprintf(out, "    if ((b[%u] = mm_malloc(%u)) == NULL) return -1;\n",
+		op->index, op->size);
+	break;
+    case TZ_REALLOC:
+	fprintf(out, "    if ((b[%u] = mm_realloc(b[%u], %u)) == NULL) "
+		"return -1;\n", op->index, op->index, op->size);
+	break;
+    default:
+	fprintf(out, "    mm_free(b[%u]);\n", op->index);
+	break;
+    }
+    (*count)++;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    tz_header_t hdr;
+    tz_reader_t *r = NULL;
+    tz_op_t op, ops[TZ_BLOCK_OPS];
+    const char *name;
+    int i, n, count = 0;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: rep2c <infile> <outfile.c>\n");
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "rb")) == NULL)
+	unix_error(argv[1]);
+    if ((out = fopen(argv[2], "w")) == NULL)
+	unix_error(argv[2]);
+    name = (strrchr(argv[1], '/') != NULL) ? strrchr(argv[1], '/') + 1
+					   : argv[1];
+
+    if (tz_is_compressed(in)) {
+	if ((r = tz_reader_open(in, &hdr)) == NULL)
+	    app_error("rep2c: not a compressed tracefile");
+    } else if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+		      &hdr.num_ops, &hdr.weight) != 4)
+	app_error("rep2c: malformed tracefile header");
+    if (hdr.num_ids < 1)
+	app_error("rep2c: tracefile has no blocks");
+
+    fprintf(out, "/* Generated by rep2c from %s; do not edit. */\n", name);
+    fprintf(out, "#include <stddef.h>\n\n#include \"mm.h\"\n\n");
+    fprintf(out, "const char *mm_compiled_trace = \"%s\";\n", name);
+    fprintf(out, "const int mm_compiled_ops = %d;\n\n", hdr.num_ops);
+    fprintf(out, "static void *b[%d];\n\n", hdr.num_ids);
+
+    if (r != NULL) {
+	while ((n = tz_read_block(r, ops)) > 0)
+	    for (i = 0; i < n; i++)
+		emit_op(out, &ops[i], hdr.num_ids, &count);
+	if (n < 0)
+	    app_error("rep2c: corrupt block");
+	tz_reader_close(r);
+    } else {
+	while (read_op(in, &op))
+	    emit_op(out, &op, hdr.num_ids, &count);
+    }
+    if (count != hdr.num_ops)
+	app_error("rep2c: request count doesn't match the header");
+    if (count > 0)
+	fprintf(out, "    return 0;\n}\n\n");
+
+    fprintf(out, "int mm_compiled_replay(void)\n{\n");
+    for (i = 0; i * CHUNK_OPS < count; i++)
+	fprintf(out, "    if (part%d() < 0) return -1;\n", i);
+    fprintf(out, "    return 0;\n}\n");
+
+    fclose(in);
+    if (fclose(out) != 0)
+	unix_error("rep2c: close failed");
+    return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * repz.c - Convert between text tracefiles (.rep) and compressed
+ *          tracefiles (.repz).
+ *
+ * usage: repz <in.rep> <out.repz>     compress
+ *        repz -d <in.repz> <out.rep>  decompress
+ *
+ * Timestamps (see the README) are carried over when the input has them.
+ * Compression makes two passes over the input: the first builds the
+ * size dictionary from the sizes that occur more than once, the second
+ * encodes the requests. Neither pass holds the trace in memory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tracez.h"
+
+#define MAXLINE 1024
+
+/* Occurrence count of one distinct request size */
+typedef struct {
+    unsigned size;
+    unsigned count;   /* 0 if the slot is empty */
+} size_count_t;
+
+static size_count_t *counts;
+static unsigned counts_mask;
+static unsigned counts_used;
+
+static void unix_error(char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+/*
+ * grow_counts - Double the size histogram
+ */
+static void grow_counts(void)
+{
+    size_count_t *old = counts;
+    unsigned old_slots = counts ? counts_mask + 1 : 0;
+    unsigned nslots = old_slots ? 2 * old_slots : 1024;
+    unsigned i;
+
+    if ((counts = calloc(nslots, sizeof(size_count_t))) == NULL)
+	unix_error("calloc failed in grow_counts");
+    counts_mask = nslots - 1;
+    counts_used = 0;
+    for (i = 0; i < old_slots; i++) {
+	if (old[i].count) {
+	    unsigned h;
+	    for (h = (old[i].size * 2654435761u) & counts_mask; counts[h].count;
+		 h = (h + 1) & counts_mask)
+		;
+	    counts[h] = old[i];
+	    counts_used++;
+	}
+    }
+    free(old);
+}
+
+/*
+ * count_size - Add one occurrence of size to the histogram
+ */
+static void count_size(unsigned size)
+{
+    unsigned h;
+
+    if (counts == NULL || 2 * (counts_used + 1) > counts_mask + 1)
+	grow_counts();
+    for (h = (size * 2654435761u) & counts_mask; counts[h].count;
+	 h = (h + 1) & counts_mask) {
+	if (counts[h].size == size) {
+	    counts[h].count++;
+	    return;
+	}
+    }
+    counts[h].size = size;
+    counts[h].count = 1;
+    counts_used++;
+}
+
+static int by_count_desc(const void *a, const void *b)
+{
+    const size_count_t *x = a, *y = b;
+
+    if (x->count != y->count)
+	return (x->count < y->count) ? 1 : -1;
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+/*
+ * read_header - Read the four header numbers of a text tracefile
+ */
+static void read_header(FILE *fp, tz_header_t *hdr)
+{
+    if (fscanf(fp, "%d %d %d %d", &hdr->sugg_heapsize, &hdr->num_ids,
+	       &hdr->num_ops, &hdr->weight) != 4)
+	app_error("repz: malformed tracefile header");
+}
+
+/*
+ * read_op - Read the next request of a text tracefile, which may end
+ *     with a timestamp column. Returns 0 at EOF, otherwise 1 for an
+ *     untimed request and 2 for a timed one.
+ */
+static int read_op(FILE *fp, tz_op_t *op)
+{
+    char line[MAXLINE];
+    char type[MAXLINE];
+    int n;
+
+    do {
+	if (fgets(line, MAXLINE, fp) == NULL)
+	    return 0;
+    } while (sscanf(line, "%s", type) != 1);
+
+    op->type = type[0];
+    op->size = 0;
+    op->stamp = 0;
+    switch (type[0]) {
+    case TZ_ALLOC:
+    case TZ_REALLOC:
+	n = sscanf(line, "%*s %u %u %llu", &op->index, &op->size, &op->stamp);
+	if (n < 2)
+	    app_error("repz: malformed request");
+	return n - 1;
+    case TZ_FREE:
+	n = sscanf(line, "%*s %u %llu", &op->index, &op->stamp);
+	if (n < 1)
+	    app_error("repz: malformed request");
+	return n;
+    default:
+	fprintf(stderr, "repz: bogus type character (%c)\n", type[0]);
+	exit(1);
+    }
+}
+
+static void compress(FILE *in, FILE *out)
+{
+    tz_header_t hdr, hdr_again;
+    tz_writer_t *w;
+    tz_op_t op;
+    unsigned *dict;
+    int dict_len = 0;
+    unsigned i;
+    int n;
+
+    /* Pass 1: histogram of alloc/realloc sizes */
+    read_header(in, &hdr);
+    hdr.timed = -1;
+    while ((n = read_op(in, &op)) != 0) {
+	if (hdr.timed < 0)
+	    hdr.timed = (n == 2);
+	else if (hdr.timed != (n == 2))
+	    app_error("repz: timestamps must be given for all requests or none");
+	if (op.type != TZ_FREE)
+	    count_size(op.size);
+    }
+    if (hdr.timed < 0)
+	hdr.timed = 0;
+
+    /* Keep the most frequent sizes that repeat */
+    if (counts != NULL)
+	qsort(counts, counts_mask + 1, sizeof(size_count_t), by_count_desc);
+    if ((dict = malloc(TZ_MAX_DICT * sizeof(unsigned))) == NULL)
+	unix_error("malloc failed in compress");
+    for (i = 0; counts != NULL && i <= counts_mask && dict_len < TZ_MAX_DICT;
+	 i++) {
+	if (counts[i].count < 2)
+	    break;
+	dict[dict_len++] = counts[i].size;
+    }
+
+    /* Pass 2: encode */
+    rewind(in);
+    read_header(in, &hdr_again);
+    if ((w = tz_writer_open(out, &hdr, dict, dict_len)) == NULL)
+	app_error("repz: could not start output");
+    while (read_op(in, &op))
+	if (tz_write_op(w, &op) < 0)
+	    unix_error("repz: write failed");
+    if (tz_writer_close(w) < 0)
+	unix_error("repz: write failed");
+    free(dict);
+}
+
+static void decompress(FILE *in, FILE *out)
+{
+    tz_header_t hdr;
+    tz_reader_t *r;
+    tz_op_t ops[TZ_BLOCK_OPS];
+    int i, n;
+
+    if ((r = tz_reader_open(in, &hdr)) == NULL)
+	app_error("repz: not a compressed tracefile");
+    fprintf(out, "%d\n%d\n%d\n%d\n", hdr.sugg_heapsize, hdr.num_ids,
+	    hdr.num_ops, hdr.weight);
+    while ((n = tz_read_block(r, ops)) > 0) {
+	for (i = 0; i < n; i++) {
+	    if (ops[i].type == TZ_FREE)
+		fprintf(out, "f %u", ops[i].index);
+	    else
+		fprintf(out, "%c %u %u", ops[i].type, ops[i].index,
+			ops[i].size);
+	    if (hdr.timed)
+		fprintf(out, " %llu", ops[i].stamp);
+	    putc('\n', out);
+	}
+    }
+    if (n < 0)
+	app_error("repz: corrupt block");
+    tz_reader_close(r);
+}
+
+int main(int argc, char **argv)
+{
+    int decode = (argc == 4 && !strcmp(argv[1], "-d"));
+    FILE *in, *out;
+
+    if (argc != 3 + decode) {
+	fprintf(stderr, "usage: repz [-d] <infile> <outfile>\n");
+	exit(1);
+    }
+    if ((in = fopen(argv[1 + decode], decode ? "rb" : "r")) == NULL)
+	unix_error(argv[1 + decode]);
+    if ((out = fopen(argv[2 + decode], decode ? "w" : "wb")) == NULL)
+	unix_error(argv[2 + decode]);
+
+    if (decode)
+	decompress(in, out);
+    else
+	compress(in, out);
+
+    fclose(in);
+    if (fclose(out) != 0)
+	unix_error("repz: close failed");
+    return 0;
+}
@@ -0,0 +1,475 @@
+/*
+ * tracez.c - encoder and streaming decoder for compressed tracefiles
+ *
+ * FILE LAYOUT
+ *   "MZTZ", version byte, flags byte
+ *   varint sugg_heapsize, num_ids, num_ops, weight
+ *   varint dict_len, then dict_len varint sizes
+ *   zero or more blocks
+ *   varint 0 (end marker)
+ *
+ * BLOCK LAYOUT
+ *   varint nops     number of requests in the block (1..TZ_BLOCK_OPS)
+ *   varint next_id  id expected for the next fresh allocation
+ *   varint nbytes   length of the block body
+ *   varint stamp    time of the block's first request (timed traces only)
+ *   body            (nops+3)/4 bytes of 2-bit request types, followed by
+ *                   one record per request: varint zigzag(id - next_id),
+ *                   and for alloc/realloc a varint size code. In a timed
+ *                   trace the records are followed by one varint per
+ *                   request giving zigzag(stamp - previous stamp).
+ *
+ * Allocation ids in a trace are handed out in order, so an alloc almost
+ * always codes as a single zero byte, and frees of young blocks code as
+ * small negative deltas. A size code below dict_len names a dictionary
+ * entry; anything else is the literal size plus dict_len. Varints are
+ * little-endian base 128, and stamps use 64-bit varints. Bit 0 of the
+ * flags byte marks a timed trace.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracez.h"
+
+#define TZ_MAGIC   "MZTZ"
+#define TZ_VERSION 1
+#define TZ_F_TIMED 0x01
+
+/* Worst case encoded size of one request, and of a block body */
+#define MAX_VARINT   5
+#define MAX_VARINT64 10
+#define MAX_BODY     ((TZ_BLOCK_OPS + 3) / 4 + \
+		      TZ_BLOCK_OPS * (2 * MAX_VARINT + MAX_VARINT64))
+
+/* 2-bit type codes inside a block */
+enum { CODE_ALLOC, CODE_REALLOC, CODE_FREE };
+
+#define ZIGZAG(d)   (((unsigned)(d) << 1) ^ (unsigned)((d) >> 31))
+#define UNZIGZAG(u) ((int)((u) >> 1) ^ -(int)((u) & 1))
+#define ZIGZAG64(d)   (((unsigned long long)(d) << 1) ^ \
+		       (unsigned long long)((d) >> 63))
+#define UNZIGZAG64(u) ((long long)((u) >> 1) ^ -(long long)((u) & 1))
+
+/* Maps a size back to its dictionary code during encoding */
+typedef struct {
+    unsigned size;
+    int code;          /* -1 if the slot is empty */
+} dict_slot_t;
+
+struct tz_writer {
+    FILE *fp;
+    int dict_len;
+    dict_slot_t *slots;
+    unsigned mask;                /* number of slots - 1 */
+    int timed;
+    tz_op_t ops[TZ_BLOCK_OPS];    /* requests of the block being built */
+    int nops;
+    unsigned next_id;
+    unsigned char body[MAX_BODY];
+    int error;
+};
+
+struct tz_reader {
+    FILE *fp;
+    int timed;
+    int dict_len;
+    unsigned *dict;
+    unsigned char body[MAX_BODY];
+};
+
+/*
+ * put_varint - Append v to buf, returning the number of bytes used
+ */
+static inline int put_varint(unsigned char *buf, unsigned v)
+{
+    int n = 0;
+
+    while (v >= 0x80) {
+	buf[n++] = (unsigned char)(v | 0x80);
+	v >>= 7;
+    }
+    buf[n++] = (unsigned char)v;
+    return n;
+}
+
+/*
+ * get_varint - Decode a varint at *pp, never reading at or past end.
+ *     Returns 0 if the varint is truncated or too long.
+ */
+static inline int get_varint(const unsigned char **pp,
+			     const unsigned char *end, unsigned *v)
+{
+    const unsigned char *p = *pp;
+    unsigned result = 0;
+    int shift;
+
+    for (shift = 0; shift < 7 * MAX_VARINT; shift += 7) {
+	if (p >= end)
+	    return 0;
+	result |= (unsigned)(*p & 0x7f) << shift;
+	if ((*p++ & 0x80) == 0) {
+	    *pp = p;
+	    *v = result;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static inline int put_varint64(unsigned char *buf, unsigned long long v)
+{
+    int n = 0;
+
+    while (v >= 0x80) {
+	buf[n++] = (unsigned char)(v | 0x80);
+	v >>= 7;
+    }
+    buf[n++] = (unsigned char)v;
+    return n;
+}
+
+static inline int get_varint64(const unsigned char **pp,
+			       const unsigned char *end, unsigned long long *v)
+{
+    const unsigned char *p = *pp;
+    unsigned long long result = 0;
+    int shift;
+
+    for (shift = 0; shift < 7 * MAX_VARINT64; shift += 7) {
+	if (p >= end)
+	    return 0;
+	result |= (unsigned long long)(*p & 0x7f) << shift;
+	if ((*p++ & 0x80) == 0) {
+	    *pp = p;
+	    *v = result;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/*
+ * read_varint - Decode a varint straight from a stream (headers only)
+ */
+static int read_varint(FILE *fp, unsigned *v)
+{
+    unsigned result = 0;
+    int shift, c;
+
+    for (shift = 0; shift < 7 * MAX_VARINT; shift += 7) {
+	if ((c = getc(fp)) == EOF)
+	    return 0;
+	result |= (unsigned)(c & 0x7f) << shift;
+	if ((c & 0x80) == 0) {
+	    *v = result;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static int read_varint64(FILE *fp, unsigned long long *v)
+{
+    unsigned long long result = 0;
+    int shift, c;
+
+    for (shift = 0; shift < 7 * MAX_VARINT64; shift += 7) {
+	if ((c = getc(fp)) == EOF)
+	    return 0;
+	result |= (unsigned long long)(c & 0x7f) << shift;
+	if ((c & 0x80) == 0) {
+	    *v = result;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static unsigned hash_size(unsigned size)
+{
+    return size * 2654435761u;
+}
+
+/*
+ * tz_is_compressed - Peek at the magic number without consuming it
+ */
+int tz_is_compressed(FILE *fp)
+{
+    char magic[4];
+    long pos = ftell(fp);
+    int match;
+
+    match = (fread(magic, 1, 4, fp) == 4 && memcmp(magic, TZ_MAGIC, 4) == 0);
+    fseek(fp, pos, SEEK_SET);
+    return match;
+}
+
+/******************
+ * Encoding
+ ******************/
+
+/*
+ * tz_writer_open - Write the file header and dictionary to fp
+ */
+tz_writer_t *tz_writer_open(FILE *fp, const tz_header_t *hdr,
+			    const unsigned *dict, int dict_len)
+{
+    tz_writer_t *w;
+    unsigned char buf[6 + 5 * MAX_VARINT];
+    unsigned nslots, h;
+    int i, n;
+
+    if (dict_len < 0 || dict_len > TZ_MAX_DICT)
+	return NULL;
+    if ((w = calloc(1, sizeof(tz_writer_t))) == NULL)
+	return NULL;
+
+    for (nslots = 16; nslots < 2 * (unsigned)dict_len; nslots <<= 1)
+	;
+    if ((w->slots = malloc(nslots * sizeof(dict_slot_t))) == NULL) {
+	free(w);
+	return NULL;
+    }
+    for (h = 0; h < nslots; h++)
+	w->slots[h].code = -1;
+    w->mask = nslots - 1;
+    for (i = 0; i < dict_len; i++) {
+	for (h = hash_size(dict[i]) & w->mask; w->slots[h].code >= 0;
+	     h = (h + 1) & w->mask)
+	    ;
+	w->slots[h].size = dict[i];
+	w->slots[h].code = i;
+    }
+    w->dict_len = dict_len;
+    w->timed = hdr->timed;
+    w->fp = fp;
+
+    memcpy(buf, TZ_MAGIC, 4);
+    buf[4] = TZ_VERSION;
+    buf[5] = hdr->timed ? TZ_F_TIMED : 0;
+    n = 6;
+    n += put_varint(buf + n, hdr->sugg_heapsize);
+    n += put_varint(buf + n, hdr->num_ids);
+    n += put_varint(buf + n, hdr->num_ops);
+    n += put_varint(buf + n, hdr->weight);
+    n += put_varint(buf + n, dict_len);
+    fwrite(buf, 1, n, fp);
+    for (i = 0; i < dict_len; i++) {
+	n = put_varint(buf, dict[i]);
+	fwrite(buf, 1, n, fp);
+    }
+    if (ferror(fp))
+	w->error = 1;
+    return w;
+}
+
+/*
+ * size_code - Dictionary code for size, or the escaped literal
+ */
+static unsigned size_code(tz_writer_t *w, unsigned size)
+{
+    unsigned h;
+
+    for (h = hash_size(size) & w->mask; w->slots[h].code >= 0;
+	 h = (h + 1) & w->mask)
+	if (w->slots[h].size == size)
+	    return w->slots[h].code;
+    return size + w->dict_len;
+}
+
+/*
+ * flush_block - Encode and write the pending requests as one block
+ */
+static void flush_block(tz_writer_t *w)
+{
+    unsigned char hdr[3 * MAX_VARINT + MAX_VARINT64];
+    unsigned char *types = w->body;
+    unsigned char *p;
+    unsigned next_id = w->next_id;
+    unsigned long long stamp;
+    int i, n, code;
+
+    if (w->nops == 0)
+	return;
+
+    n = (w->nops + 3) / 4;
+    memset(types, 0, n);
+    p = types + n;
+    for (i = 0; i < w->nops; i++) {
+	tz_op_t *op = &w->ops[i];
+
+	code = (op->type == TZ_ALLOC) ? CODE_ALLOC :
+	    (op->type == TZ_REALLOC) ? CODE_REALLOC : CODE_FREE;
+	types[i / 4] |= code << (2 * (i % 4));
+	p += put_varint(p, ZIGZAG((int)(op->index - next_id)));
+	if (code != CODE_FREE)
+	    p += put_varint(p, size_code(w, op->size));
+	if (code == CODE_ALLOC)
+	    next_id = op->index + 1;
+    }
+    if (w->timed) {
+	stamp = w->ops[0].stamp;
+	for (i = 0; i < w->nops; i++) {
+	    p += put_varint64(p, ZIGZAG64((long long)(w->ops[i].stamp - stamp)));
+	    stamp = w->ops[i].stamp;
+	}
+    }
+
+    n = put_varint(hdr, w->nops);
+    n += put_varint(hdr + n, w->next_id);
+    n += put_varint(hdr + n, (unsigned)(p - w->body));
+    if (w->timed)
+	n += put_varint64(hdr + n, w->ops[0].stamp);
+    fwrite(hdr, 1, n, w->fp);
+    fwrite(w->body, 1, p - w->body, w->fp);
+    if (ferror(w->fp))
+	w->error = 1;
+
+    w->next_id = next_id;
+    w->nops = 0;
+}
+
+/*
+ * tz_write_op - Queue one request, writing out a block when full
+ */
+int tz_write_op(tz_writer_t *w, const tz_op_t *op)
+{
+    if (op->type != TZ_ALLOC && op->type != TZ_REALLOC && op->type != TZ_FREE)
+	return -1;
+    w->ops[w->nops++] = *op;
+    if (w->nops == TZ_BLOCK_OPS)
+	flush_block(w);
+    return w->error ? -1 : 0;
+}
+
+/*
+ * tz_writer_close - Write the last block and the end marker
+ */
+int tz_writer_close(tz_writer_t *w)
+{
+    int error;
+
+    flush_block(w);
+    putc(0, w->fp);
+    if (fflush(w->fp) != 0)
+	w->error = 1;
+    error = w->error;
+    free(w->slots);
+    free(w);
+    return error ? -1 : 0;
+}
+
+/******************
+ * Decoding
+ ******************/
+
+/*
+ * tz_reader_open - Read the file header and dictionary from fp
+ */
+tz_reader_t *tz_reader_open(FILE *fp, tz_header_t *hdr)
+{
+    tz_reader_t *r;
+    unsigned char magic[6];
+    unsigned v[5];
+    int i;
+
+    if (fread(magic, 1, 6, fp) != 6 || memcmp(magic, TZ_MAGIC, 4) != 0 ||
+	magic[4] != TZ_VERSION || (magic[5] & ~TZ_F_TIMED) != 0)
+	return NULL;
+    for (i = 0; i < 5; i++)
+	if (!read_varint(fp, &v[i]))
+	    return NULL;
+    if (v[4] > TZ_MAX_DICT)
+	return NULL;
+
+    if ((r = malloc(sizeof(tz_reader_t))) == NULL)
+	return NULL;
+    if ((r->dict = malloc((v[4] + 1) * sizeof(unsigned))) == NULL) {
+	free(r);
+	return NULL;
+    }
+    for (i = 0; i < (int)v[4]; i++) {
+	if (!read_varint(fp, &r->dict[i])) {
+	    tz_reader_close(r);
+	    return NULL;
+	}
+    }
+    r->dict_len = v[4];
+    r->timed = (magic[5] & TZ_F_TIMED) != 0;
+    r->fp = fp;
+
+    hdr->sugg_heapsize = v[0];
+    hdr->num_ids = v[1];
+    hdr->num_ops = v[2];
+    hdr->weight = v[3];
+    hdr->timed = r->timed;
+    return r;
+}
+
+/*
+ * tz_read_block - Decode the next block into ops[0..TZ_BLOCK_OPS-1]
+ */
+int tz_read_block(tz_reader_t *r, tz_op_t *ops)
+{
+    unsigned nops, next_id, nbytes, u, code;
+    unsigned long long stamp = 0, delta;
+    const unsigned char *types = r->body;
+    const unsigned char *p, *end;
+    unsigned i;
+
+    if (!read_varint(r->fp, &nops))
+	return -1;
+    if (nops == 0)
+	return 0;
+    if (nops > TZ_BLOCK_OPS || !read_varint(r->fp, &next_id) ||
+	!read_varint(r->fp, &nbytes) || nbytes > MAX_BODY ||
+	nbytes < (nops + 3) / 4 ||
+	(r->timed && !read_varint64(r->fp, &stamp)) ||
+	fread(r->body, 1, nbytes, r->fp) != nbytes)
+	return -1;
+
+    p = r->body + (nops + 3) / 4;
+    end = r->body + nbytes;
+    for (i = 0; i < nops; i++) {
+	code = (types[i / 4] >> (2 * (i % 4))) & 3;
+	if (!get_varint(&p, end, &u))
+	    return -1;
+	ops[i].index = next_id + UNZIGZAG(u);
+	switch (code) {
+	case CODE_ALLOC:
+	    ops[i].type = TZ_ALLOC;
+	    next_id = ops[i].index + 1;
+	    break;
+	case CODE_REALLOC:
+	    ops[i].type = TZ_REALLOC;
+	    break;
+	case CODE_FREE:
+	    ops[i].type = TZ_FREE;
+	    ops[i].size = 0;
+	    continue;
+	default:
+	    return -1;
+	}
+	if (!get_varint(&p, end, &u))
+	    return -1;
+	ops[i].size = (u < (unsigned)r->dict_len) ? r->dict[u] : u - r->dict_len;
+    }
+    for (i = 0; i < nops; i++) {
+	if (r->timed) {
+	    if (!get_varint64(&p, end, &delta))
+		return -1;
+	    stamp += UNZIGZAG64(delta);
+	}
+	ops[i].stamp = stamp;
+    }
+    return (p == end) ? (int)nops : -1;
+}
+
+/*
+ * tz_reader_close - Release the decoder (the stream is left open)
+ */
+void tz_reader_close(tz_reader_t *r)
+{
+    free(r->dict);
+    free(r);
+}
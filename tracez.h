@@ -0,0 +1,51 @@
+/*
+ * tracez.h - compressed, delta-encoded trace files
+ *
+ * A .repz file holds the same information as a text .rep file, split
+ * into blocks of at most TZ_BLOCK_OPS requests. Every block can be
+ * decoded on its own given only the file header, so a reader never
+ * needs more than one block in memory.
+ */
+#include <stdio.h>
+
+/* Request types, spelled the same way as in a text tracefile */
+#define TZ_ALLOC   'a'
+#define TZ_REALLOC 'r'
+#define TZ_FREE    'f'
+
+#define TZ_BLOCK_OPS 4096       /* max requests per block */
+#define TZ_MAX_DICT  (1 << 16)  /* max entries in the size dictionary */
+
+/* The numbers at the top of every tracefile */
+typedef struct {
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int weight;
+    int timed;         /* 1 if every request carries a timestamp */
+} tz_header_t;
+
+/* One request as seen by the encoder and decoder */
+typedef struct {
+    char type;         /* TZ_ALLOC, TZ_REALLOC or TZ_FREE */
+    unsigned index;    /* block id */
+    unsigned size;     /* byte size (unused for TZ_FREE) */
+    unsigned long long stamp; /* capture time in ns (timed traces only) */
+} tz_op_t;
+
+typedef struct tz_writer tz_writer_t;
+typedef struct tz_reader tz_reader_t;
+
+/* Returns 1 if fp is positioned at the start of a .repz stream */
+int tz_is_compressed(FILE *fp);
+
+/* Encoding: dict lists the sizes worth a short code, most frequent first */
+tz_writer_t *tz_writer_open(FILE *fp, const tz_header_t *hdr,
+			    const unsigned *dict, int dict_len);
+int tz_write_op(tz_writer_t *w, const tz_op_t *op);
+int tz_writer_close(tz_writer_t *w);
+
+/* Decoding: tz_read_block returns the number of ops, 0 at end, -1 on error */
+tz_reader_t *tz_reader_open(FILE *fp, tz_header_t *hdr);
+int tz_read_block(tz_reader_t *r, tz_op_t *ops);
+void tz_reader_close(tz_reader_t *r);